@@ -0,0 +1,324 @@
+/*  open8610  - batch8610 batch record decoder
+ *  This file contains decoders that turn runs of raw history records
+ *  into field arrays, for reprocessing large captures.
+ *
+ *  A record is at most 15 bytes, so the SIMD kernels load the 16 byte
+ *  window starting at each record as four 32 bit words, one record per
+ *  vector lane, and decode all fields of 4 (SSE2) or 8 (AVX2) records
+ *  at once with shifts, masks and adds.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "batch8610.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BATCH_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*batch_kernel)(const struct record_layout *layout, unsigned char *data,
+                             int first, int count, struct record_columns *out);
+
+static int selected_kernel = BATCH_AUTO;
+
+/* BCD digit k of a record, see RECORD_T0_NIBBLE */
+#define NIB(record, k)      (((record)[(k) >> 1] >> (((k) & 1) * 4)) & 0xF)
+#define BCD(record, b)      (NIB(record, 2 * (b) + 1) * 10 + NIB(record, 2 * (b)))
+
+
+/********************************************************************
+ * decode_scalar
+ * Decodes records one by one, also used for the tail the SIMD
+ * kernels leave over
+ *
+ * Input:   layout - record format
+ *          data - raw records, record 0 at the start
+ *          first - first record to decode
+ *          count - records in data
+ *
+ * Output:  out - entries first to count-1 of the field arrays
+ *
+ ********************************************************************/
+static void decode_scalar(const struct record_layout *layout, unsigned char *data,
+                          int first, int count, struct record_columns *out)
+{
+    int i, ch, n;
+
+    for (i = first; i < count; i++)
+    {
+        unsigned char *record = data + i * layout->length;
+
+        out->minute[i] = BCD(record, 0);
+        out->hour[i] = BCD(record, 1);
+        out->day[i] = BCD(record, 2);
+        out->month[i] = BCD(record, 3);
+        out->year[i] = BCD(record, 4);
+        for (ch = 0; ch < layout->channels; ch++)
+        {
+            n = layout->temp_nibble[ch];
+            out->temp[ch][i] = NIB(record, n + 2) * 100 + NIB(record, n + 1) * 10 +
+                               NIB(record, n) - 300;
+            n = layout->rh_nibble[ch];
+            out->rh[ch][i] = NIB(record, n + 1) * 10 + NIB(record, n);
+        }
+    }
+}
+
+
+#ifdef BATCH_X86
+
+/* Records whose 16 byte window still lies inside the buffer */
+static int vector_records(const struct record_layout *layout, int count)
+{
+    int over = 16 - layout->length;     // bytes a window reads past its record
+
+    return count - (over + layout->length - 1) / layout->length;
+}
+
+static uint32_t load32(unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/*** SSE2, 8 records per round as two vectors of 4 ***/
+
+#define SSE2 __attribute__((target("sse2")))
+
+SSE2 static inline __m128i sse2_mul10(__m128i x)
+{
+    return _mm_add_epi32(_mm_slli_epi32(x, 3), _mm_slli_epi32(x, 1));
+}
+
+SSE2 static inline __m128i sse2_nib(__m128i *w, int k)
+{
+    return _mm_and_si128(_mm_srl_epi32(w[k >> 3], _mm_cvtsi32_si128((k & 7) * 4)),
+                         _mm_set1_epi32(0xF));
+}
+
+SSE2 static inline __m128i sse2_bcd(__m128i *w, int b)
+{
+    return _mm_add_epi32(sse2_mul10(sse2_nib(w, 2 * b + 1)), sse2_nib(w, 2 * b));
+}
+
+SSE2 static inline __m128i sse2_temp(__m128i *w, int n)
+{
+    __m128i t = _mm_add_epi32(sse2_mul10(sse2_nib(w, n + 2)), sse2_nib(w, n + 1));
+
+    return _mm_sub_epi32(_mm_add_epi32(sse2_mul10(t), sse2_nib(w, n)), _mm_set1_epi32(300));
+}
+
+SSE2 static inline __m128i sse2_rh(__m128i *w, int n)
+{
+    return _mm_add_epi32(sse2_mul10(sse2_nib(w, n + 1)), sse2_nib(w, n));
+}
+
+SSE2 static inline void sse2_store(int16_t *dst, __m128i a, __m128i b)
+{
+    _mm_storeu_si128((__m128i *)dst, _mm_packs_epi32(a, b));
+}
+
+SSE2 static void decode_sse2(const struct record_layout *layout, unsigned char *data,
+                             int first, int count, struct record_columns *out)
+{
+    int len = layout->length;
+    int last = vector_records(layout, count);
+    __m128i w[2][4];
+    int i, h, k, ch;
+
+    for (i = first; i + 8 <= last; i += 8)
+    {
+        for (h = 0; h < 2; h++)
+        {
+            unsigned char *p = data + (i + 4 * h) * len;
+
+            for (k = 0; k < 4; k++)
+                w[h][k] = _mm_set_epi32(load32(p + 3 * len + 4 * k), load32(p + 2 * len + 4 * k),
+                                        load32(p + len + 4 * k), load32(p + 4 * k));
+        }
+
+        sse2_store(out->minute + i, sse2_bcd(w[0], 0), sse2_bcd(w[1], 0));
+        sse2_store(out->hour + i, sse2_bcd(w[0], 1), sse2_bcd(w[1], 1));
+        sse2_store(out->day + i, sse2_bcd(w[0], 2), sse2_bcd(w[1], 2));
+        sse2_store(out->month + i, sse2_bcd(w[0], 3), sse2_bcd(w[1], 3));
+        sse2_store(out->year + i, sse2_bcd(w[0], 4), sse2_bcd(w[1], 4));
+        for (ch = 0; ch < layout->channels; ch++)
+        {
+            sse2_store(out->temp[ch] + i, sse2_temp(w[0], layout->temp_nibble[ch]),
+                       sse2_temp(w[1], layout->temp_nibble[ch]));
+            sse2_store(out->rh[ch] + i, sse2_rh(w[0], layout->rh_nibble[ch]),
+                       sse2_rh(w[1], layout->rh_nibble[ch]));
+        }
+    }
+
+    decode_scalar(layout, data, i, count, out);
+}
+
+/*** AVX2, 16 records per round as two gathers of 8 ***/
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i avx2_mul10(__m256i x)
+{
+    return _mm256_add_epi32(_mm256_slli_epi32(x, 3), _mm256_slli_epi32(x, 1));
+}
+
+AVX2 static inline __m256i avx2_nib(__m256i *w, int k)
+{
+    return _mm256_and_si256(_mm256_srl_epi32(w[k >> 3], _mm_cvtsi32_si128((k & 7) * 4)),
+                            _mm256_set1_epi32(0xF));
+}
+
+AVX2 static inline __m256i avx2_bcd(__m256i *w, int b)
+{
+    return _mm256_add_epi32(avx2_mul10(avx2_nib(w, 2 * b + 1)), avx2_nib(w, 2 * b));
+}
+
+AVX2 static inline __m256i avx2_temp(__m256i *w, int n)
+{
+    __m256i t = _mm256_add_epi32(avx2_mul10(avx2_nib(w, n + 2)), avx2_nib(w, n + 1));
+
+    return _mm256_sub_epi32(_mm256_add_epi32(avx2_mul10(t), avx2_nib(w, n)),
+                            _mm256_set1_epi32(300));
+}
+
+AVX2 static inline __m256i avx2_rh(__m256i *w, int n)
+{
+    return _mm256_add_epi32(avx2_mul10(avx2_nib(w, n + 1)), avx2_nib(w, n));
+}
+
+AVX2 static inline void avx2_store(int16_t *dst, __m256i a, __m256i b)
+{
+    // packs works per 128 bit half, put the records back in order
+    _mm256_storeu_si256((__m256i *)dst,
+                        _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8));
+}
+
+AVX2 static void decode_avx2(const struct record_layout *layout, unsigned char *data,
+                             int first, int count, struct record_columns *out)
+{
+    int len = layout->length;
+    int last = vector_records(layout, count);
+    __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                       _mm256_set1_epi32(len));
+    __m256i w[2][4];
+    int i, h, k, ch;
+
+    for (i = first; i + 16 <= last; i += 16)
+    {
+        for (h = 0; h < 2; h++)
+            for (k = 0; k < 4; k++)
+                w[h][k] = _mm256_i32gather_epi32((const int *)(data + (i + 8 * h) * len + 4 * k),
+                                                 index, 1);
+
+        avx2_store(out->minute + i, avx2_bcd(w[0], 0), avx2_bcd(w[1], 0));
+        avx2_store(out->hour + i, avx2_bcd(w[0], 1), avx2_bcd(w[1], 1));
+        avx2_store(out->day + i, avx2_bcd(w[0], 2), avx2_bcd(w[1], 2));
+        avx2_store(out->month + i, avx2_bcd(w[0], 3), avx2_bcd(w[1], 3));
+        avx2_store(out->year + i, avx2_bcd(w[0], 4), avx2_bcd(w[1], 4));
+        for (ch = 0; ch < layout->channels; ch++)
+        {
+            avx2_store(out->temp[ch] + i, avx2_temp(w[0], layout->temp_nibble[ch]),
+                       avx2_temp(w[1], layout->temp_nibble[ch]));
+            avx2_store(out->rh[ch] + i, avx2_rh(w[0], layout->rh_nibble[ch]),
+                       avx2_rh(w[1], layout->rh_nibble[ch]));
+        }
+    }
+
+    // Finish with SSE2, it leaves only the last few records to scalar
+    decode_sse2(layout, data, i, count, out);
+}
+
+#endif /* BATCH_X86 */
+
+
+/********************************************************************
+ * batch_select
+ * Chooses the decoder kernel, normally left at BATCH_AUTO
+ *
+ * Input:   kernel - BATCH_AUTO, BATCH_SCALAR, BATCH_SSE2 or BATCH_AVX2
+ *
+ * Returns: 0 on success, -1 if the CPU cannot run that kernel
+ *
+ ********************************************************************/
+int batch_select(int kernel)
+{
+#ifdef BATCH_X86
+    __builtin_cpu_init();
+    if ((kernel == BATCH_SSE2 && !__builtin_cpu_supports("sse2")) ||
+        (kernel == BATCH_AVX2 && !__builtin_cpu_supports("avx2")))
+        return -1;
+#else
+    if (kernel == BATCH_SSE2 || kernel == BATCH_AVX2)
+        return -1;
+#endif
+    if (kernel == BATCH_AUTO)
+    {
+        kernel = BATCH_SCALAR;
+#ifdef BATCH_X86
+        if (__builtin_cpu_supports("avx2"))
+            kernel = BATCH_AVX2;
+        else if (__builtin_cpu_supports("sse2"))
+            kernel = BATCH_SSE2;
+#endif
+    }
+
+    selected_kernel = kernel;
+    return 0;
+}
+
+/********************************************************************
+ * batch_kernel_name
+ *
+ * Returns: name of the kernel decode_records() uses, for logging
+ *
+ ********************************************************************/
+const char *batch_kernel_name(void)
+{
+    static const char *names[] = {"auto", "scalar", "sse2", "avx2"};
+
+    if (selected_kernel == BATCH_AUTO)
+        batch_select(BATCH_AUTO);
+    return names[selected_kernel];
+}
+
+/********************************************************************
+ * decode_records
+ * Decodes contiguous raw history records into field arrays
+ *
+ * Input:   layout - record format, see get_record_layout()
+ *          data - count records of layout->length bytes
+ *          count - number of records
+ *
+ * Output:  out - count entries of every field array
+ *
+ ********************************************************************/
+void decode_records(const struct record_layout *layout, unsigned char *data,
+                    int count, struct record_columns *out)
+{
+    batch_kernel kernel = decode_scalar;
+    int i, ch;
+
+    if (selected_kernel == BATCH_AUTO)
+        batch_select(BATCH_AUTO);
+#ifdef BATCH_X86
+    if (selected_kernel == BATCH_AVX2)
+        kernel = decode_avx2;
+    else if (selected_kernel == BATCH_SSE2)
+        kernel = decode_sse2;
+#endif
+
+    kernel(layout, data, 0, count, out);
+
+    for (ch = layout->channels; ch < 4; ch++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            out->temp[ch][i] = RECORD_TENTHS_INVALID;
+            out->rh[ch][i] = RECORD_RH_INVALID;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+/* Include file for the open8610 batch record decoder
+ *
+ * Decodes runs of raw history records, e.g. a whole captured ring,
+ * into one array per field. There is a scalar decoder and SSE2/AVX2
+ * kernels, the fastest one the CPU supports is picked at runtime.
+ */
+
+#ifndef _INCLUDE_BATCH8610_H_
+#define _INCLUDE_BATCH8610_H_
+
+#include "rw8610.h"
+#include <stdint.h>
+
+#define BATCH_AUTO      0       // fastest kernel the CPU supports
+#define BATCH_SCALAR    1
+#define BATCH_SSE2      2
+#define BATCH_AVX2      3
+
+/* Output arrays, each holding one entry per record. Temperatures are
+ * in tenths of a degree Celsius, the date fields are the plain numbers
+ * of the station clock (year 0-99 meaning 2000-2099). Channels the
+ * record format does not store are filled with RECORD_TENTHS_INVALID and
+ * RECORD_RH_INVALID. */
+struct record_columns
+{
+    int16_t *minute;
+    int16_t *hour;
+    int16_t *day;
+    int16_t *month;
+    int16_t *year;
+    int16_t *temp[4];
+    int16_t *rh[4];
+};
+
+int batch_select(int kernel);
+
+const char *batch_kernel_name(void);
+
+void decode_records(const struct record_layout *layout, unsigned char *data,
+                    int count, struct record_columns *out);
+
+#endif /* _INCLUDE_BATCH8610_H_ */
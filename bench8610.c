@@ -0,0 +1,288 @@
+/*  open8610 - bench8610.c
+ *
+ *  Benchmark of the open8610 protocol and decoders on the simulator
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "rw8610.h"
+#include "sim8610.h"
+#include "batch8610.h"
+
+#define BENCH_MIN_NS        200000000LL     // each read size runs at least this long
+#define BENCH_NOISE_BYTES   4096            // bytes per read under noise
+#define BENCH_NOISE_READS   8
+#define BENCH_RECORDS       65536           // records per decode run
+#define BENCH_DECODE_RUNS   8
+
+static const int read_sizes[] = { 1, 64, 32768 };
+static const double noise_rates[] = { 0.0, 0.00001, 0.0001, 0.001 };
+
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+    printf("\n");
+    printf("bench8610 - Measure the protocol and record decoding on the simulator.\n");
+    printf("This program is released under the GNU General Public License (GPL)\n\n");
+    printf("Usage:\n");
+    printf("bench8610 [-o jsonfile] [-d bit_delay_ns] [memmapfile]\n");
+    printf("Results are written as JSON to stdout or jsonfile. The bit delay\n");
+    printf("defaults to 0 to measure the cost of the host side only.\n");
+    exit(0);
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/********************************************************************
+ * bench_read times read_safe() of one size, repeated for at least
+ * BENCH_MIN_NS
+ *
+ * Input:   out - JSON output
+ *          ws - simulated weatherstation
+ *          number - bytes per read
+ *
+ ********************************************************************/
+static void bench_read(FILE *out, WEATHERSTATION ws, int number)
+{
+    unsigned char data[32768];
+    unsigned long ioctls = ws->stats.ioctls;
+    long long start = now_ns(), elapsed;
+    int reads = 0;
+
+    do
+    {
+        if (read_safe(ws, 0, number, data) == -1)
+        {
+            fprintf(stderr, "bench8610: read of %d bytes failed\n", number);
+            exit(-1);
+        }
+        reads++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    fprintf(out, "    {\"bytes\": %d, \"reads\": %d, \"ns_per_read\": %.0f, "
+            "\"bits_per_s\": %.0f, \"ioctls_per_byte\": %.2f}",
+            number, reads, (double)elapsed / reads,
+            8.0 * number * reads / (elapsed / 1e9),
+            (double)(ws->stats.ioctls - ioctls) / ((double)number * reads));
+}
+
+/********************************************************************
+ * bench_noise reads with CTS errors injected and counts how often
+ * blocks were read again, reads gave up and wrong bytes got through.
+ * The simulated memory is filled with bytes that are neither 0x00 nor
+ * 0xFF first, so a wrong byte cannot hide as a suspicious one that
+ * VERIFY_SINGLE re-reads. The mismatch rate carries over from row to
+ * row like on a link getting noisier.
+ *
+ * Input:   out - JSON output
+ *          ws - simulated weatherstation
+ *          rate - chance of a wrong CTS read
+ *
+ ********************************************************************/
+static void bench_noise(FILE *out, WEATHERSTATION ws, double rate)
+{
+    unsigned char data[BENCH_NOISE_BYTES];
+    unsigned char *memory = sim_memory(ws);
+    unsigned long blocks = ws->stats.blocks, retries = ws->retry_count;
+    long long start;
+    int i, j, failed = 0, corrupt = 0;
+
+    for (i = 0; i < BENCH_NOISE_READS * BENCH_NOISE_BYTES; i++)
+        memory[i] = 0x01 + (i * 37) % 0xFD;
+
+    sim_set_noise(ws, rate, 1);
+    start = now_ns();
+    for (i = 0; i < BENCH_NOISE_READS; i++)
+    {
+        if (read_safe(ws, i * BENCH_NOISE_BYTES, BENCH_NOISE_BYTES, data) == -1)
+        {
+            failed++;
+            continue;
+        }
+        for (j = 0; j < BENCH_NOISE_BYTES; j++)
+            corrupt += data[j] != memory[i * BENCH_NOISE_BYTES + j];
+    }
+    sim_set_noise(ws, 0, 0);
+
+    blocks = ws->stats.blocks - blocks;
+    retries = ws->retry_count - retries;
+    fprintf(out, "    {\"noise\": %g, \"blocks\": %lu, \"retry_rate\": %.4f, "
+            "\"failed_reads\": %d, \"corrupt_bytes\": %d, \"ns_per_byte\": %.0f}",
+            rate, blocks, blocks ? (double)retries / blocks : 0.0, failed, corrupt,
+            (double)(now_ns() - start) / (BENCH_NOISE_READS * BENCH_NOISE_BYTES));
+}
+
+static unsigned char bcd(int value)
+{
+    return (value / 10) << 4 | value % 10;
+}
+
+/********************************************************************
+ * bench_decode times the record decoders for one record format on
+ * records 5 minutes apart with random readings
+ *
+ * Input:   out - JSON output
+ *          o_count - count of additional outdoor sensors
+ *
+ ********************************************************************/
+static void bench_decode(FILE *out, int o_count)
+{
+    const struct record_layout *layout = get_record_layout(o_count);
+    static unsigned char data[BENCH_RECORDS * 16];
+    static struct packed_record packed[BENCH_RECORDS];
+    static int16_t fields[13][BENCH_RECORDS];
+    struct record_columns columns;
+    struct station_clock sc;
+    unsigned int seed = 1;
+    time_t t = 1577836800;      // 1/1/2020
+    long long start, packed_ns, batch_ns;
+    int i, j, ch;
+
+    for (i = 0; i < BENCH_RECORDS; i++, t += 300)
+    {
+        unsigned char *record = data + i * layout->length;
+        struct tm tm;
+
+        for (j = 5; j < layout->length; j++)
+            record[j] = bcd(rand_r(&seed) % 100);
+        gmtime_r(&t, &tm);
+        record[0] = bcd(tm.tm_min);
+        record[1] = bcd(tm.tm_hour);
+        record[2] = bcd(tm.tm_mday);
+        record[3] = bcd(tm.tm_mon + 1);
+        record[4] = bcd(tm.tm_year % 100);
+    }
+
+    columns.minute = fields[0];
+    columns.hour = fields[1];
+    columns.day = fields[2];
+    columns.month = fields[3];
+    columns.year = fields[4];
+    for (ch = 0; ch < 4; ch++)
+    {
+        columns.temp[ch] = fields[5 + ch];
+        columns.rh[ch] = fields[9 + ch];
+    }
+
+    // Untimed first runs so page faults and cold caches do not count
+    station_clock_init(&sc, 1);
+    decode_packed_records(layout, data, BENCH_RECORDS, &sc, packed);
+    decode_records(layout, data, BENCH_RECORDS, &columns);
+
+    start = now_ns();
+    for (i = 0; i < BENCH_DECODE_RUNS; i++)
+    {
+        station_clock_init(&sc, 1);
+        decode_packed_records(layout, data, BENCH_RECORDS, &sc, packed);
+    }
+    packed_ns = now_ns() - start;
+
+    start = now_ns();
+    for (i = 0; i < BENCH_DECODE_RUNS; i++)
+        decode_records(layout, data, BENCH_RECORDS, &columns);
+    batch_ns = now_ns() - start;
+
+    fprintf(out, "    {\"record_length\": %d, \"channels\": %d, "
+            "\"packed_records_per_s\": %.0f, \"batch_records_per_s\": %.0f}",
+            layout->length, layout->channels,
+            (double)BENCH_RECORDS * BENCH_DECODE_RUNS / (packed_ns / 1e9),
+            (double)BENCH_RECORDS * BENCH_DECODE_RUNS / (batch_ns / 1e9));
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program opens a simulated station and measures read_safe() for
+ * a few sizes, its retries under injected line noise and the decoding
+ * of each history record format. The results go out as one JSON object
+ * so they can be compared from build to build.
+ *
+ * The config file is read for the verify mode and block size, the
+ * device and bit delay are set by the command line.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+    WEATHERSTATION ws;
+    FILE *out = stdout;
+    char device[300] = "sim:";
+    char *image = SIM_DEFAULT_IMAGE;
+    long bit_delay = 0;
+    int i;
+
+    get_configuration(&config, "");
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            if ((out = fopen(argv[++i], "w")) == NULL)
+            {
+                printf("Cannot open file %s\n", argv[i]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            bit_delay = atol(argv[++i]);
+        else if (argv[i][0] == '-')
+            print_usage();
+        else
+            image = argv[i];
+    }
+    config.bit_delay = bit_delay;
+    config.log_level = 0;
+    strncat(device, image, sizeof(device) - strlen(device) - 1);
+
+    ws = open_weatherstation(device);
+
+    fprintf(out, "{\n  \"time\": %ld,\n  \"bit_delay_ns\": %ld,\n", (long)time(NULL), bit_delay);
+    fprintf(out, "  \"read_chunk\": %d,\n  \"verify\": %d,\n", config.read_chunk, config.verify);
+    fprintf(out, "  \"batch_kernel\": \"%s\",\n", batch_kernel_name());
+    fprintf(out, "  \"connect_ms\": %.3f,\n", ws->connect_ns / 1e6);
+
+    fprintf(out, "  \"read\": [\n");
+    for (i = 0; i < (int)(sizeof(read_sizes) / sizeof(read_sizes[0])); i++)
+    {
+        bench_read(out, ws, read_sizes[i]);
+        fprintf(out, i + 1 < (int)(sizeof(read_sizes) / sizeof(read_sizes[0])) ? ",\n" : "\n");
+    }
+
+    fprintf(out, "  ],\n  \"noise\": [\n");
+    for (i = 0; i < (int)(sizeof(noise_rates) / sizeof(noise_rates[0])); i++)
+    {
+        bench_noise(out, ws, noise_rates[i]);
+        fprintf(out, i + 1 < (int)(sizeof(noise_rates) / sizeof(noise_rates[0])) ? ",\n" : "\n");
+    }
+
+    fprintf(out, "  ],\n  \"decode\": [\n");
+    for (i = 0; i < 3; i++)
+    {
+        bench_decode(out, i);
+        fprintf(out, i + 1 < 3 ? ",\n" : "\n");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    close_weatherstation(ws);
+    if (out != stdout)
+        fclose(out);
+
+    return(0);
+}
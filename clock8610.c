@@ -0,0 +1,178 @@
+/*  open8610  - clock8610 station clock conversion
+ *  This file converts the local date and time kept by the station to
+ *  time_t. Days are counted with plain calendar arithmetic; the C
+ *  library is only asked for the UTC offset, once per local day.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "clock8610.h"
+
+#define DAY_SECONDS     86400LL
+#define OFFSET_MAX      (14 * 3600LL)   // largest UTC offset in use
+
+
+/* Seconds east of UTC at a given instant */
+static long utc_offset(time_t t)
+{
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    return tm.tm_gmtoff;
+}
+
+/********************************************************************
+ * load_day
+ * Fills the cache with the UTC offsets of a local day. If the offset
+ * changes during the day, the instant of the change is found by
+ * bisection over the UTC span the day can cover.
+ *
+ * Input:   sc - converter
+ *          day_number - local day, days since 1/1/1970
+ *
+ ********************************************************************/
+static void load_day(struct station_clock *sc, long day_number)
+{
+    long long lo = day_number * DAY_SECONDS - OFFSET_MAX;
+    long long hi = (day_number + 1) * DAY_SECONDS + OFFSET_MAX;
+    long long mid;
+
+    sc->day_number = day_number;
+    sc->passed_change = 0;
+    sc->offset_before = utc_offset(lo);
+    sc->offset_after = utc_offset(hi);
+    if (sc->offset_before == sc->offset_after)
+        return;
+
+    // utc_offset(lo) is offset_before, utc_offset(hi) is not
+    while (hi - lo > 1)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (utc_offset(mid) == sc->offset_before)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    sc->change_utc = hi;
+}
+
+
+/********************************************************************
+ * station_clock_init
+ *
+ * Input:   sc - converter to set up
+ *          sequential - 1 if times will be converted in record order,
+ *                       so the hour repeated at the end of DST can be
+ *                       told apart, 0 for random access
+ *
+ ********************************************************************/
+void station_clock_init(struct station_clock *sc, int sequential)
+{
+    sc->day_number = CLOCK_NO_DAY;
+    sc->sequential = sequential;
+    sc->passed_change = 0;
+    sc->last_local = 0;
+}
+
+/********************************************************************
+ * station_clock_follow
+ * Tells a sequential converter the time of the record preceding the
+ * next one it converts, e.g. when a sync resumes where it left off
+ *
+ * Input:   sc - converter
+ *          previous - time_t of the preceding record
+ *
+ ********************************************************************/
+void station_clock_follow(struct station_clock *sc, time_t previous)
+{
+    long long local = previous + utc_offset(previous);
+    long day_number = local / DAY_SECONDS - (local % DAY_SECONDS < 0);
+
+    load_day(sc, day_number);
+    sc->passed_change = sc->offset_before != sc->offset_after &&
+                        previous >= sc->change_utc;
+    sc->last_local = local;
+}
+
+/********************************************************************
+ * days_from_civil
+ * Counts days in the proleptic Gregorian calendar
+ *
+ * Input:   year, month (1-12), day (1-31)
+ *
+ * Returns: days since 1/1/1970
+ *
+ ********************************************************************/
+long days_from_civil(long year, int month, int day)
+{
+    long era, yoe, doy;
+
+    // Count years from March so the leap day is the last of the year
+    year -= month <= 2;
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - era * 400;
+    doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+
+    return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+/********************************************************************
+ * station_clock_time
+ * Converts a station date and time to time_t.
+ *
+ * In the hour skipped when DST starts the offset from before the
+ * change is used. In the hour repeated when DST ends a random access
+ * converter always picks the first pass; a sequential one switches to
+ * the second pass once a time earlier than the previous one, or one
+ * past the repeated hour, has been converted on that day.
+ *
+ * Input:   sc - converter
+ *          year (e.g. 2011), month (1-12), day, hour, minute
+ *
+ * Returns: seconds since 1/1/70 UTC
+ *
+ ********************************************************************/
+time_t station_clock_time(struct station_clock *sc, int year, int month,
+                          int day, int hour, int minute)
+{
+    long day_number = days_from_civil(year, month, day);
+    long long local = day_number * DAY_SECONDS + hour * 3600 + minute * 60;
+    long long first, second;
+    long offset;
+
+    if (day_number != sc->day_number)
+        load_day(sc, day_number);
+
+    if (sc->offset_before == sc->offset_after)
+        offset = sc->offset_before;
+    else
+    {
+        // Local times around the change: before 'first' only the old
+        // offset applies, from 'second' on only the new one
+        first = sc->change_utc + sc->offset_after;
+        second = sc->change_utc + sc->offset_before;
+        if (first > second)
+        {
+            // Clock went forward, nothing is ambiguous
+            offset = local < first ? sc->offset_before : sc->offset_after;
+        }
+        else if (local < first)
+            offset = sc->offset_before;
+        else if (local >= second)
+        {
+            offset = sc->offset_after;
+            sc->passed_change = 1;
+        }
+        else
+        {
+            // Repeated hour
+            if (sc->sequential && local < sc->last_local && sc->last_local >= first)
+                sc->passed_change = 1;
+            offset = sc->sequential && sc->passed_change ?
+                     sc->offset_after : sc->offset_before;
+        }
+    }
+
+    sc->last_local = local;
+    return (time_t)(local - offset);
+}
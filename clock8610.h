@@ -0,0 +1,41 @@
+/* Include file for the open8610 station clock conversion
+ *
+ * The station keeps local civil time, radio controlled and so
+ * following daylight saving time. These functions turn its date and
+ * time into time_t without asking the C library for every record.
+ */
+
+#ifndef _INCLUDE_CLOCK8610_H_
+#define _INCLUDE_CLOCK8610_H_
+
+#include <time.h>
+#include <limits.h>
+
+#define CLOCK_NO_DAY    LONG_MIN        // day_number of an empty cache
+
+/* Converter state. The UTC offsets of the last local day converted are
+ * cached. A sequential converter also remembers the previous time so
+ * the hour repeated when DST ends is resolved by the order of the
+ * records: times in it count as the first (summer time) pass until the
+ * clock has been seen stepping back, the second pass after that. */
+struct station_clock
+{
+    long day_number;            // local day cached, days since 1/1/1970
+    long offset_before;         // seconds east of UTC when the day starts
+    long offset_after;          // seconds east of UTC when the day ends
+    long long change_utc;       // instant the offset changes, if it does
+    int sequential;             // resolve the repeated hour by record order
+    int passed_change;          // the clock has stepped back on this day
+    long long last_local;       // previous time converted, local seconds
+};
+
+void station_clock_init(struct station_clock *sc, int sequential);
+
+void station_clock_follow(struct station_clock *sc, time_t previous);
+
+long days_from_civil(long year, int month, int day);
+
+time_t station_clock_time(struct station_clock *sc, int year, int month,
+                          int day, int hour, int minute);
+
+#endif /* _INCLUDE_CLOCK8610_H_ */
@@ -0,0 +1,347 @@
+/*  open8610  - daemon8610 daemon protocol functions
+ *  This file contains both ends of the open8610d socket protocol:
+ *  the request handler used by the daemon and the unix: transport
+ *  that turns the programs into thin clients of the daemon.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "daemon8610.h"
+
+
+/* read() and write() until all bytes are moved, 0 on success */
+static int read_full(int fd, void *buffer, int size)
+{
+    unsigned char *p = buffer;
+    int ret;
+
+    while (size > 0)
+    {
+        ret = read(fd, p, size);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        p += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+static int write_full(int fd, void *buffer, int size)
+{
+    unsigned char *p = buffer;
+    int ret;
+
+    while (size > 0)
+    {
+        ret = write(fd, p, size);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        p += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+
+/********************************************************************
+ * daemon_listen
+ * Creates the listening socket of the daemon, replacing a stale
+ * socket file left behind by an earlier run
+ *
+ * Input:   path - socket file name
+ *
+ * Returns: listening socket, -1 on error
+ *
+ ********************************************************************/
+int daemon_listen(char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, DAEMON_MAX_CLIENTS) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/********************************************************************
+ * daemon_accept
+ * Accepts a client of the daemon. The daemon serves its clients one
+ * request at a time, so a client that stops halfway through a request
+ * gets DAEMON_CLIENT_TIMEOUT before it is dropped instead of holding
+ * up the others.
+ *
+ * Input:   listen_fd - socket from daemon_listen()
+ *
+ * Returns: client socket, -1 on error
+ *
+ ********************************************************************/
+int daemon_accept(int listen_fd)
+{
+    struct timeval timeout = { DAEMON_CLIENT_TIMEOUT, 0 };
+    int fd;
+
+    if ((fd = accept(listen_fd, NULL, NULL)) < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+/********************************************************************
+ * daemon_serve
+ * Reads one request from a client and answers it
+ *
+ * Input:   ws - handle to the weatherstation, NULL while the station
+ *               is lost, requests then fail
+ *          fd - client socket
+ *
+ * Returns: 0 if the request was served, -1 if the client is gone or
+ *          sent a malformed request
+ *
+ ********************************************************************/
+int daemon_serve(WEATHERSTATION ws, int fd)
+{
+    struct daemon_request request;
+    struct daemon_reply reply;
+    unsigned char data[DAEMON_MAX_DATA];
+
+    if (read_full(fd, &request, sizeof(request)) < 0)
+        return -1;
+    if (request.number < 0 || request.number > DAEMON_MAX_DATA ||
+        request.address < 0 || request.address > 0x7FFF)
+        return -1;
+
+    LOG(2, "open8610d - request %c 0x%04X %d", request.op,
+        request.address, request.number);
+
+    switch (request.op)
+    {
+    case DAEMON_READ:
+    case DAEMON_READ_EXACT:
+        if (ws == NULL)
+            reply.status = -1;
+        else if (request.op == DAEMON_READ)
+            reply.status = read_safe(ws, request.address, request.number, data);
+        else
+            reply.status = read_exact(ws, request.address, request.number, data);
+        if (write_full(fd, &reply, sizeof(reply)) < 0)
+            return -1;
+        if (reply.status > 0 && write_full(fd, data, reply.status) < 0)
+            return -1;
+        return 0;
+
+    case DAEMON_WRITE:
+        if (read_full(fd, data, request.number) < 0)
+            return -1;
+        if (ws == NULL)
+            reply.status = -1;
+        else
+            reply.status = write_data(ws, request.address, request.number, data);
+        return write_full(fd, &reply, sizeof(reply));
+
+    default:
+        return -1;
+    }
+}
+
+
+/********************************************************************
+ * daemon_metrics_listen
+ * Creates the TCP socket the link statistics are served on
+ *
+ * Input:   port - TCP port, on all addresses
+ *
+ * Returns: listening socket, -1 on error
+ *
+ ********************************************************************/
+int daemon_metrics_listen(int port)
+{
+    struct sockaddr_in addr;
+    int fd, on = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, DAEMON_MAX_CLIENTS) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/********************************************************************
+ * daemon_metrics_serve
+ * Answers one HTTP request on an accepted metrics connection with the
+ * link statistics and closes it. Whatever the path, the answer is the
+ * metrics; a client gets DAEMON_HTTP_TIMEOUT to send its request so a
+ * stuck scraper cannot hold up the station clients for long.
+ *
+ * Input:   ws - handle to the weatherstation
+ *          fd - accepted connection, closed on return
+ *
+ * Returns: 0 on success, -1 on error
+ *
+ ********************************************************************/
+int daemon_metrics_serve(WEATHERSTATION ws, int fd)
+{
+    struct timeval timeout = { DAEMON_HTTP_TIMEOUT, 0 };
+    char request[1024];
+    FILE *fileptr;
+    int ret;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (read(fd, request, sizeof(request)) <= 0 ||
+        (fileptr = fdopen(fd, "w")) == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    fprintf(fileptr, "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Connection: close\r\n\r\n");
+    ret = stats_write(fileptr, ws, config.serial_device_name);
+    if (fclose(fileptr) != 0)
+        ret = -1;
+    return ret;
+}
+
+/********************************************************************
+ * unix_open, daemon client transport
+ * Connects to open8610d
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *          device - socket file name of the daemon
+ *
+ * Returns: 0 on success, -1 if the daemon cannot be reached
+ *
+ ********************************************************************/
+static int unix_open(WEATHERSTATION ws, char *device)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(device) >= sizeof(addr.sun_path))
+    {
+        printf("\nSocket name too long %s\n", device);
+        return -1;
+    }
+    strcpy(addr.sun_path, device);
+
+    if ((ws->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        connect(ws->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        printf("\nUnable to connect to open8610d at %s\n", device);
+        if (ws->fd >= 0)
+            close(ws->fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void unix_close(WEATHERSTATION ws)
+{
+    close(ws->fd);
+}
+
+static int unix_read_block(WEATHERSTATION ws, int address, int number,
+                           unsigned char *readdata, int zeros)
+{
+    struct daemon_request request;
+    struct daemon_reply reply;
+
+    request.op = zeros ? DAEMON_READ_EXACT : DAEMON_READ;
+    request.address = address & 0x7FFF;    // wraps like in the station
+    request.number = number;
+    if (write_full(ws->fd, &request, sizeof(request)) < 0 ||
+        read_full(ws->fd, &reply, sizeof(reply)) < 0)
+        return -1;
+    if (reply.status > number)
+        return -1;
+    if (reply.status > 0 && read_full(ws->fd, readdata, reply.status) < 0)
+        return -1;
+    if (reply.status > 0)
+        ws->stats.line_bytes += reply.status;
+
+    return reply.status;
+}
+
+static int unix_write_block(WEATHERSTATION ws, int address, int number,
+                            unsigned char *writedata)
+{
+    struct daemon_request request;
+    struct daemon_reply reply;
+
+    request.op = DAEMON_WRITE;
+    request.address = address & 0x7FFF;    // wraps like in the station
+    request.number = number;
+    if (write_full(ws->fd, &request, sizeof(request)) < 0 ||
+        write_full(ws->fd, writedata, number) < 0 ||
+        read_full(ws->fd, &reply, sizeof(reply)) < 0)
+        return -1;
+
+    return reply.status;
+}
+
+static void unix_set_line(WEATHERSTATION ws, int val)
+{
+}
+
+static int unix_get_line(WEATHERSTATION ws)
+{
+    return 0;
+}
+
+static int unix_read_device(WEATHERSTATION ws, unsigned char *buffer, int size)
+{
+    return 0;
+}
+
+static int unix_write_device(WEATHERSTATION ws, unsigned char *buffer, int size)
+{
+    return size;
+}
+
+const struct transport8610 unix_transport = {
+    "unix",
+    unix_open,
+    unix_close,
+    unix_set_line,
+    unix_set_line,
+    unix_get_line,
+    unix_get_line,
+    unix_read_device,
+    unix_write_device,
+    unix_read_block,
+    unix_write_block,
+    NULL
+};
@@ -0,0 +1,47 @@
+/* Include file for the open8610 daemon protocol
+ *
+ * open8610d keeps the station open and serves read_safe() and
+ * write_data() over a Unix domain socket. Programs become clients of
+ * the daemon by setting the device name to unix:socketpath.
+ */
+
+#ifndef _INCLUDE_DAEMON8610_H_
+#define _INCLUDE_DAEMON8610_H_
+
+#include "rw8610.h"
+#include <stdint.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#define DAEMON_READ         'R'     // read_safe(address, number)
+#define DAEMON_READ_EXACT   'E'     // read_exact(address, number)
+#define DAEMON_WRITE        'W'     // write_data(address, number, data)
+#define DAEMON_MAX_DATA     32768
+#define DAEMON_MAX_CLIENTS  16
+#define DAEMON_KEEPALIVE    60      // seconds idle before touching the link
+#define DAEMON_REOPEN_EVERY 10      // seconds between tries to reopen a lost station
+#define DAEMON_CLIENT_TIMEOUT 5     // seconds a client may take to send a request
+#define DAEMON_METRICS_EVERY 60     // seconds between METRICS_FILE writes
+#define DAEMON_HTTP_TIMEOUT 1       // seconds a metrics client may take
+
+struct daemon_request
+{
+    int32_t op;
+    int32_t address;
+    int32_t number;                 // followed by number bytes for writes
+};
+
+struct daemon_reply
+{
+    int32_t status;                 // followed by status bytes for reads
+};
+
+extern const struct transport8610 unix_transport;
+
+int daemon_listen(char *path);
+int daemon_accept(int listen_fd);
+int daemon_serve(WEATHERSTATION ws, int fd);
+int daemon_metrics_listen(int port);
+int daemon_metrics_serve(WEATHERSTATION ws, int fd);
+
+#endif /* _INCLUDE_DAEMON8610_H_ */
@@ -10,6 +10,7 @@
  */
 
 #include "rw8610.h"
+#include "image8610.h"
 
 
 /********************************************************************
@@ -34,6 +35,52 @@ void print_usage(void)
     printf("Usage:\n");
     printf("dump8610 filename start_address end_address\n");
     printf("Addresses in hex, range 0-7FFF\n");
+    printf("dump8610 -i imagefile [start_address end_address]\n");
+    printf("Capture memory (all of it by default) to a station image\n");
+    printf("that can be used as device image:imagefile\n");
+    exit(0);
+}
+
+
+/********************************************************************
+ * capture_image reads an address range into a station image file
+ *
+ * Input:   ws - handle to the weatherstation
+ *          filename - image file to write
+ *          start_adr, end_adr - range to capture
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+static void capture_image(WEATHERSTATION ws, char *filename,
+                          int start_adr, int end_adr)
+{
+    unsigned char data[IMAGE_MEMORY_SIZE];
+    struct image_range range;
+    time_t capture_time = time(NULL);
+    int o_count;
+
+    memset(data, 0xFF, sizeof(data));
+    if (read_safe(ws, start_adr, end_adr - start_adr + 1, data + start_adr) == -1)
+    {
+        printf("\nError reading data\n");
+        close_weatherstation(ws);
+        exit(0);
+    }
+
+    if (start_adr <= 0x0C && end_adr >= 0x0C)
+        o_count = (data[0x0C] & 0x0F) - 1;
+    else
+        o_count = outdoor_count(ws);
+    close_weatherstation(ws);
+
+    range.start = start_adr;
+    range.length = end_adr - start_adr + 1;
+    if (image_write(filename, data, &range, 1, capture_time, o_count) == -1)
+    {
+        printf("Cannot write image %s\n", filename);
+        exit(0);
+    }
     exit(0);
 }
 
@@ -55,10 +102,12 @@ int main(int argc, char *argv[])
     WEATHERSTATION ws;
     FILE *fileptr;
     unsigned char data[32768];
+    static struct sink out, file_out;
+    time_t read_time;
+    char str[100];
 
     int i;
     int start_adr, end_adr;
-    struct config_type config;
 
     // Get in-data and select mode.
 
@@ -68,6 +117,26 @@ int main(int argc, char *argv[])
 
     get_configuration(&config, "");
 
+    if (argc >= 3 && strcmp(argv[1], "-i") == 0)
+    {
+        start_adr = 0;
+        end_adr = 0x7FFF;
+        if (argc == 5)
+        {
+            start_adr = strtol(argv[3],NULL,16);
+            end_adr = strtol(argv[4],NULL,16);
+        }
+        else if (argc != 3)
+            print_usage();
+        if (start_adr < 0 || end_adr > 0x7FFF || start_adr >= end_adr)
+        {
+            printf("Address range invalid\n");
+            exit(0);
+        }
+        ws = open_weatherstation(config.serial_device_name);
+        capture_image(ws, argv[2], start_adr, end_adr);
+    }
+
     if (argc!=4)
     {
         print_usage();
@@ -95,6 +164,7 @@ int main(int argc, char *argv[])
         exit(0);
     }
 
+    read_time = time(NULL);
     if (read_safe(ws, start_adr, end_adr-start_adr + 1, data) == -1) {
         printf("\nError reading data\n");
         close_weatherstation(ws);
@@ -102,14 +172,44 @@ int main(int argc, char *argv[])
         exit(0);
     }
 
-    // Write out the data
+    LOG(1, "%lu ioctls for %lu bytes, %.1f ioctls per byte",
+        ws->stats.ioctls, ws->stats.line_bytes,
+        (double)ws->stats.ioctls / ws->stats.line_bytes);
+
+    // Write out the data. As text stdout gets a line per address and
+    // the file rows of 8 bytes, the other formats a record per address
+    // to both
+    sink_open(&out, config.output_format, 1);
+    sink_add_fd(&out, STDOUT_FILENO);
+    if (config.output_format == SINK_TEXT)
+    {
+        sink_open(&file_out, SINK_TEXT, 0);
+        sink_add_fd(&file_out, fileno(fileptr));
+    }
+    else
+        sink_add_fd(&out, fileno(fileptr));
+
     for (i=0; i<=end_adr-start_adr; i++)
     {
-        printf("Address: %04X - Data: %02X\n",start_adr+i,data[i]);
-        // fprintf(fileptr,"Address: %04X - Data: %02X\n",start_adr+i,data[i]);
-        if ((i / 8) * 8 == i) fprintf(fileptr,"\n%04X: ",start_adr+i);
-        fprintf(fileptr,"%02X ",data[i]);
+        if (config.output_format == SINK_TEXT)
+        {
+            sink_printf(&out, "Address: %04X - Data: %02X\n", start_adr + i, data[i]);
+            if ((i / 8) * 8 == i)
+                sink_printf(&file_out, "\n%04X: ", start_adr + i);
+            sink_hex(&file_out, data + i, 1);
+            continue;
+        }
+
+        sink_begin(&out, "ws8610_memory", read_time);
+        sprintf(str, "%d", start_adr + i);
+        sink_number(&out, "address", str);
+        sprintf(str, "%d", data[i]);
+        sink_number(&out, "data", str);
+        sink_end(&out);
     }
+    sink_close(&out);
+    if (config.output_format == SINK_TEXT)
+        sink_close(&file_out);
 
 
     // Goodbye and Goodnight
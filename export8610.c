@@ -0,0 +1,199 @@
+/*  open8610  - export8610 columnar history export
+ *  This file writes decoded history records as one contiguous array
+ *  per field, see export8610.h for the file layout.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "export8610.h"
+
+#define EXPORT_MAX_COLUMNS  (1 + 4 * 4)
+#define VARINT_MAX          10      // bytes of the longest 64 bit varint
+
+struct export_column
+{
+    uint16_t type;
+    uint16_t channel;
+    uint32_t encoding;
+    uint64_t offset;
+    uint64_t length;
+};
+
+/* Little endian stores into a byte buffer */
+static void put16(unsigned char *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static void put64(unsigned char *p, uint64_t v)
+{
+    put32(p, v);
+    put32(p + 4, v >> 32);
+}
+
+/* Appends the zig-zag varint of a signed value, returns bytes used */
+static int put_varint(unsigned char *p, int64_t value)
+{
+    uint64_t v = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    int n = 0;
+
+    while (v >= 0x80)
+    {
+        p[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+
+/********************************************************************
+ * write_column
+ * Writes one column at the next aligned offset and adds it to the
+ * index
+ *
+ * Input:   fileptr - export file
+ *          offset - current end of the file, updated
+ *          column - index entry to fill in
+ *          type, channel, encoding - column description
+ *          data - encoded column
+ *          length - its length in bytes
+ *
+ * Returns: 0 on success, -1 on write error
+ *
+ ********************************************************************/
+static int write_column(FILE *fileptr, uint64_t *offset, struct export_column *column,
+                        int type, int channel, int encoding,
+                        unsigned char *data, size_t length)
+{
+    static const unsigned char zeros[EXPORT_ALIGN];
+    size_t pad = (EXPORT_ALIGN - *offset % EXPORT_ALIGN) % EXPORT_ALIGN;
+
+    if (fwrite(zeros, 1, pad, fileptr) != pad ||
+        fwrite(data, 1, length, fileptr) != length)
+        return -1;
+
+    column->type = type;
+    column->channel = channel;
+    column->encoding = encoding;
+    column->offset = *offset + pad;
+    column->length = length;
+    *offset += pad + length;
+    return 0;
+}
+
+/********************************************************************
+ * export_columns
+ * Writes records in the columnar export format
+ *
+ * Input:   fileptr - file to write to, positioned at its start
+ *          records - records in the order written by the station
+ *          count - number of records
+ *          channels - temperature/humidity channels to export (1-4)
+ *
+ * Returns: 0 on success, -1 on error
+ *
+ ********************************************************************/
+int export_columns(FILE *fileptr, struct packed_record *records, int count,
+                   int channels)
+{
+    struct export_column columns[EXPORT_MAX_COLUMNS], index;
+    unsigned char header[16], entry[24], trailer[16];
+    unsigned char *buffer;
+    uint64_t offset = sizeof(header);
+    int ncolumns = 0;
+    int64_t previous;
+    size_t length;
+    int i, ch, ret = -1;
+
+    if ((buffer = malloc((size_t)count * VARINT_MAX + 1)) == NULL)
+        return -1;
+
+    memcpy(header, EXPORT_MAGIC, 8);
+    put32(header + 8, EXPORT_VERSION);
+    put32(header + 12, count);
+    if (fwrite(header, sizeof(header), 1, fileptr) != 1)
+        goto out;
+
+    previous = 0;
+    for (i = 0, length = 0; i < count; i++)
+    {
+        length += put_varint(buffer + length, (int64_t)records[i].time - previous);
+        previous = records[i].time;
+    }
+    if (write_column(fileptr, &offset, &columns[ncolumns++], COLUMN_TIME, 0,
+                     ENCODING_DELTA_VARINT, buffer, length) < 0)
+        goto out;
+
+    for (ch = 0; ch < channels; ch++)
+    {
+        previous = 0;
+        for (i = 0, length = 0; i < count; i++)
+        {
+            if (records[i].valid & PACKED_TEMP_VALID(ch))
+            {
+                length += put_varint(buffer + length, records[i].temp[ch] - previous);
+                previous = records[i].temp[ch];
+            }
+            else
+                buffer[length++] = 0;
+        }
+        if (write_column(fileptr, &offset, &columns[ncolumns++], COLUMN_TEMP, ch,
+                         ENCODING_DELTA_VARINT, buffer, length) < 0)
+            goto out;
+
+        for (i = 0; i < count; i++)
+            buffer[i] = records[i].rh[ch];
+        if (write_column(fileptr, &offset, &columns[ncolumns++], COLUMN_RH, ch,
+                         ENCODING_UINT8, buffer, count) < 0)
+            goto out;
+
+        length = (count + 7) / 8;
+        memset(buffer, 0, length);
+        for (i = 0; i < count; i++)
+            if (records[i].valid & PACKED_TEMP_VALID(ch))
+                buffer[i / 8] |= 1 << (i % 8);
+        if (write_column(fileptr, &offset, &columns[ncolumns++], COLUMN_TEMP_VALID, ch,
+                         ENCODING_BITMAP, buffer, length) < 0)
+            goto out;
+
+        memset(buffer, 0, length);
+        for (i = 0; i < count; i++)
+            if (records[i].valid & PACKED_RH_VALID(ch))
+                buffer[i / 8] |= 1 << (i % 8);
+        if (write_column(fileptr, &offset, &columns[ncolumns++], COLUMN_RH_VALID, ch,
+                         ENCODING_BITMAP, buffer, length) < 0)
+            goto out;
+    }
+
+    // Index and trailer
+    if (write_column(fileptr, &offset, &index, 0, 0, 0, buffer, 0) < 0)
+        goto out;
+    for (i = 0; i < ncolumns; i++)
+    {
+        put16(entry, columns[i].type);
+        put16(entry + 2, columns[i].channel);
+        put32(entry + 4, columns[i].encoding);
+        put64(entry + 8, columns[i].offset);
+        put64(entry + 16, columns[i].length);
+        if (fwrite(entry, sizeof(entry), 1, fileptr) != 1)
+            goto out;
+    }
+    put64(trailer, index.offset);
+    put32(trailer + 8, ncolumns);
+    memcpy(trailer + 12, EXPORT_TRAILER_MAGIC, 4);
+    if (fwrite(trailer, sizeof(trailer), 1, fileptr) != 1)
+        goto out;
+    ret = 0;
+
+out:
+    free(buffer);
+    return ret;
+}
@@ -0,0 +1,43 @@
+/* Include file for the open8610 columnar history export
+ *
+ * File layout, all numbers little endian:
+ *
+ *   header   "WS8610CX", uint32 version, uint32 record count
+ *   columns  one after the other, each starting 8 byte aligned
+ *   index    one entry per column: uint16 type, uint16 channel,
+ *            uint32 encoding, uint64 offset, uint64 length in bytes
+ *   trailer  uint64 offset of the index, uint32 column count, "WSCX"
+ *
+ * A reader finds the index through the trailer at the end of the file
+ * and can then map a single column. Every column holds one value per
+ * record. Times and temperatures are stored as the difference to the
+ * previous record, zig-zag encoded as unsigned LEB128 varints (the
+ * first difference is to 0). Temperatures are tenths of a degree
+ * Celsius; a reading without sensor repeats the previous value and has
+ * its bit in the matching valid column cleared.
+ */
+
+#ifndef _INCLUDE_EXPORT8610_H_
+#define _INCLUDE_EXPORT8610_H_
+
+#include "rw8610.h"
+
+#define EXPORT_MAGIC            "WS8610CX"
+#define EXPORT_TRAILER_MAGIC    "WSCX"
+#define EXPORT_VERSION          1
+#define EXPORT_ALIGN            8
+
+#define COLUMN_TIME             0   // seconds since 1/1/1970 UTC
+#define COLUMN_TEMP             1   // tenths of a degree Celsius
+#define COLUMN_RH               2   // percent
+#define COLUMN_TEMP_VALID       3
+#define COLUMN_RH_VALID         4
+
+#define ENCODING_DELTA_VARINT   0   // zig-zag varint of the difference
+#define ENCODING_UINT8          1   // one byte per record
+#define ENCODING_BITMAP         2   // bit i%8 of byte i/8 for record i
+
+int export_columns(FILE *fileptr, struct packed_record *records, int count,
+                   int channels);
+
+#endif /* _INCLUDE_EXPORT8610_H_ */
@@ -0,0 +1,127 @@
+/*  open8610 - flight8610.c
+ *
+ *  Print a flight recorder dump written by the open8610 programs
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "rw8610.h"
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+    printf("\n");
+    printf("flight8610 - Print the protocol events of a flight recorder dump.\n");
+    printf("The programs write one when a read fails for good or on SIGUSR1,\n");
+    printf("to the file set with FLIGHT_RECORDER in open8610.conf.\n");
+    printf("This program is released under the GNU General Public License (GPL)\n\n");
+    printf("Usage:\n");
+    printf("flight8610 dumpfile\n");
+    exit(0);
+}
+
+static uint64_t get_le(unsigned char *p, int bytes)
+{
+    uint64_t v = 0;
+
+    while (bytes-- > 0)
+        v = v << 8 | p[bytes];
+    return v;
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program prints a flight recorder dump, one event per line with
+ * its time since the first event and since the previous one.
+ * Line events show the level, bytes their value; a written byte is
+ * followed by whether the station acknowledged it.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+    static const char *reasons[] = { "?", "signal", "read failed" };
+    unsigned char header[RECORDER_HEADER_SIZE], event[RECORDER_EVENT_SIZE];
+    FILE *fileptr;
+    uint64_t first = 0, previous = 0, t;
+    uint32_t count, reason, i;
+    time_t dump_time;
+    char datestring[40];
+    int type, value;
+    uint32_t arg;
+
+    if (argc != 2)
+        print_usage();
+
+    if ((fileptr = fopen(argv[1], "rb")) == NULL)
+    {
+        printf("Cannot open file %s\n", argv[1]);
+        exit(-1);
+    }
+
+    if (fread(header, sizeof(header), 1, fileptr) != 1 ||
+        memcmp(header, RECORDER_MAGIC, 8) != 0 ||
+        get_le(header + 8, 4) != RECORDER_VERSION)
+    {
+        printf("%s is not a flight recorder dump\n", argv[1]);
+        exit(-1);
+    }
+    count = get_le(header + 12, 4);
+    dump_time = get_le(header + 16, 8);
+    reason = get_le(header + 24, 4);
+    strftime(datestring, sizeof(datestring), "%Y-%m-%d %H:%M:%S", localtime(&dump_time));
+    printf("%u events, dumped %s (%s)\n", count, datestring,
+           reasons[reason < 3 ? reason : 0]);
+
+    for (i = 0; i < count; i++)
+    {
+        if (fread(event, sizeof(event), 1, fileptr) != 1)
+        {
+            printf("Dump truncated after %u events\n", i);
+            break;
+        }
+        t = get_le(event, 8);
+        type = get_le(event + 8, 2);
+        value = get_le(event + 10, 2);
+        arg = get_le(event + 12, 4);
+        if (i == 0)
+            first = previous = t;
+
+        printf("%12.3f us %+10.3f  %-12s", (t - first) / 1e3,
+               (double)(int64_t)(t - previous) / 1e3, recorder_event_name(type));
+        switch (type)
+        {
+        case EVENT_SET_DTR:
+        case EVENT_SET_RTS:
+        case EVENT_GET_CTS:
+        case EVENT_GET_DSR:
+            printf("%d", value);
+            break;
+        case EVENT_WRITE_BYTE:
+            printf("%02X%s", value, arg ? "" : " (no ack)");
+            break;
+        case EVENT_READ_BYTE:
+            printf("%02X", value);
+            break;
+        case EVENT_READ_BLOCK:
+        case EVENT_MISMATCH:
+        case EVENT_READ_FAILED:
+            printf("%d bytes at 0x%04X", value, arg);
+            break;
+        }
+        printf("\n");
+        previous = t;
+    }
+
+    fclose(fileptr);
+    return(0);
+}
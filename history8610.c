@@ -11,6 +11,7 @@
  */
 
 #include "rw8610.h"
+#include "export8610.h"
 
 /********************************************************************
  * print_usage prints a short user guide
@@ -32,10 +33,385 @@ void print_usage(void)
     printf("Usage:\n");
     printf("history8610 filename start_record end_record\n");
     printf("Record number in dec, range 0 - 3200\n");
+    printf("history8610 -s filename statefile\n");
+    printf("Append the records written since the last run to the file\n");
+    printf("history8610 -a archivefile statefile\n");
+    printf("Same, appending binary packed records to an archive\n");
+    printf("history8610 -c exportfile start_record end_record\n");
+    printf("history8610 -c exportfile archivefile\n");
+    printf("Write records from the station or an archive as columns\n");
     exit(0);
 }
 
 
+/********************************************************************
+ * write_records writes records to a sink, as raw bytes in the text
+ * format, decoded readings in the others
+ *
+ * Input:   out - sink to write to
+ *          layout - record format
+ *          data - raw records
+ *          packed - the same records decoded
+ *          count - number of records
+ *          rec_count - number printed for the first record
+ *
+ ********************************************************************/
+static void write_records(struct sink *out, const struct record_layout *layout,
+                          unsigned char *data, struct packed_record *packed,
+                          int count, int rec_count)
+{
+    struct history_record hr;
+    char str[20];
+    int i;
+
+    for (i = 0; i < count; i++, rec_count++)
+    {
+        if (out->format == SINK_TEXT)
+        {
+            sink_printf(out, "Record %04i ", rec_count);
+            sink_hex(out, data + i * layout->length, layout->length);
+            sink_printf(out, "\n");
+            continue;
+        }
+
+        unpack_record(&packed[i], &hr);
+        sprintf(str, "%d", rec_count);
+        sink_begin(out, "ws8610_history", hr.time_stamp);
+        sink_number(out, "record", str);
+        sink_history_fields(out, &hr, layout->channels);
+        sink_end(out);
+    }
+}
+
+
+/********************************************************************
+ * store_records writes records fetched by sync_history, to a sink or
+ * as packed records appended to an archive
+ *
+ * Input:   out - sink to write to, NULL for an archive
+ *          fileptr - archive file
+ *          sc - sequential station clock converter
+ *          o_count - count of additional outdoor sensors
+ *          data - raw records, in the order written
+ *          count - number of records
+ *          rec_count - number printed for the first record
+ *
+ ********************************************************************/
+static void store_records(struct sink *out, FILE *fileptr, struct station_clock *sc,
+                          int o_count, unsigned char *data, int count, int rec_count)
+{
+    const struct record_layout *layout = get_record_layout(o_count);
+    struct packed_record packed[HISTORY_BUFFER_SIZE / 10];
+
+    decode_packed_records(layout, data, count, sc, packed);
+    if (out == NULL)
+        write_packed_records(fileptr, packed, count);
+    else
+        write_records(out, layout, data, packed, count, rec_count);
+}
+
+
+/********************************************************************
+ * read_records reads consecutive records of the history ring buffer,
+ * splitting the read where the ring wraps back to record 0
+ *
+ * Input:   ws - handle to the weatherstation
+ *          first - sequence number of the first record
+ *          count - number of records, max the ring size
+ *          o_count - count of additional outdoor sensors
+ *
+ * Output:  data - raw records
+ *
+ * Returns: 0 on success, -1 on read error
+ *
+ ********************************************************************/
+static int read_records(WEATHERSTATION ws, int first, int count,
+                        int o_count, unsigned char *data)
+{
+    int record_length = get_history_record_length(o_count);
+    int record_max = get_history_record_max(o_count);
+    int slot = first % record_max;
+    int n = count;
+
+    if (slot + n > record_max)
+        n = record_max - slot;
+
+    if (read_safe(ws, HISTORY_BUFFER_ADR + slot * record_length,
+                  n * record_length, data) == -1)
+        return -1;
+    if (n < count &&
+        read_safe(ws, HISTORY_BUFFER_ADR, (count - n) * record_length,
+                  data + n * record_length) == -1)
+        return -1;
+
+    return 0;
+}
+
+
+/********************************************************************
+ * sync_history appends all records written since the last run.
+ *
+ * The state file holds the sequence number of the next record to
+ * fetch, the timestamp of the last fetched record and the record
+ * length. Records live in ring slot (sequence % ring size). While the
+ * ring is not full the history count at 0x0009 tells how far to read;
+ * once it is full the ring is followed forward from the last record
+ * for as long as timestamps keep increasing.
+ *
+ * Input:   ws - handle to the weatherstation
+ *          out - sink to append the records to, NULL for an archive
+ *          fileptr - archive to append packed records to
+ *          statefile - name of the state file
+ *
+ * Returns: number of records appended, -1 on error
+ *
+ ********************************************************************/
+static int sync_history(WEATHERSTATION ws, struct sink *out, FILE *fileptr,
+                        char *statefile)
+{
+    FILE *stateptr;
+    unsigned char data[32768];
+    struct station_header header;
+    char tmpname[1024];
+    long last_time = 0;
+    int last_rec = 0, last_length = 0;
+    int o_count, record_length, record_max, count;
+    int first, next, stored, n = 0;
+    struct station_clock sc, store_clock;
+
+    // Records are converted in the order written, which tells the two
+    // passes of the hour repeated at the end of DST apart
+    station_clock_init(&sc, 1);
+
+    // History and sensor count from a fresh header snapshot
+    if (read_history_info(ws, &header) == -1 ||
+        header.outdoor_count < 0 || header.outdoor_count > 2)
+        return -1;
+    o_count = header.outdoor_count;
+    record_length = get_history_record_length(o_count);
+    record_max = get_history_record_max(o_count);
+    count = header.record_count;
+
+    stateptr = fopen(statefile, "r");
+    if (stateptr != NULL)
+    {
+        if (fscanf(stateptr, "%d %ld %d", &last_rec, &last_time, &last_length) != 3)
+            last_rec = last_length = 0;
+        fclose(stateptr);
+    }
+
+    first = last_rec;
+    if (last_length != record_length || (count < record_max && count < last_rec))
+    {
+        // Sensor count changed or memory was reset, start over
+        LOG(1, "sync - station history restarted, reading from record 0");
+        first = 0;
+        last_time = 0;
+    }
+    else if (first > 0)
+    {
+        // The last record we fetched must still be where we left it
+        if (read_records(ws, first - 1, 1, o_count, data) == -1)
+            return -1;
+        station_clock_follow(&sc, last_time);
+        if (hist_timestamp_clock(&sc, data) != last_time)
+        {
+            LOG(1, "sync - last synced record overwritten, reading from record 0");
+            first = 0;
+            last_time = 0;
+        }
+    }
+
+    // Stored records get their own converter, sc runs ahead of them
+    station_clock_init(&store_clock, 1);
+    if (first > 0)
+        station_clock_follow(&store_clock, last_time);
+
+    if (count < record_max)
+    {
+        // Ring not full yet, the history count is the write position
+        int i;
+
+        n = count - first;
+        if (n > 0)
+        {
+            if (read_records(ws, first, n, o_count, data) == -1)
+                return -1;
+            store_records(out, fileptr, &store_clock, o_count, data, n, first);
+            for (i = 0; i < n; i++)
+                last_time = hist_timestamp_clock(&sc, data + i * record_length);
+        }
+        next = first + n;
+        stored = n;
+    }
+    else if (first == 0)
+    {
+        // First sync of a full ring: read it all, oldest record first
+        int head;
+        long t;
+
+        if (read_records(ws, 0, record_max, o_count, data) == -1)
+            return -1;
+        last_time = hist_timestamp_clock(&sc, data);
+        for (head = 0; head + 1 < record_max; head++)
+        {
+            unsigned char *record = data + (head + 1) * record_length;
+
+            if (record[0] == 0xFF || (t = hist_timestamp_clock(&sc, record)) < last_time)
+                break;
+            last_time = t;
+        }
+        for (n = head + 1; n < record_max && data[n * record_length] != 0xFF; n++)
+            ;
+        store_records(out, fileptr, &store_clock, o_count,
+                      data + (head + 1) * record_length, n - head - 1, head + 1);
+        store_records(out, fileptr, &store_clock, o_count, data, head + 1, record_max);
+        first = head + 1;
+        next = record_max + head + 1;
+        stored = n;
+    }
+    else
+    {
+        // Ring full: follow it forward while records keep getting
+        // newer, one record at a time from a cursor, which streams or
+        // reads ahead in verified blocks
+        struct read_cursor cursor;
+        int window = sizeof(data) / record_length;
+        int i = 0;
+
+        next = first;
+        cursor_open(&cursor, ws, HISTORY_BUFFER_ADR + (next % record_max) * record_length);
+        while (next - first < record_max)
+        {
+            unsigned char *record = data + i * record_length;
+            long t;
+
+            // Back to slot 0 where the ring wraps
+            cursor_seek(&cursor, HISTORY_BUFFER_ADR + (next % record_max) * record_length);
+            if (cursor_next(&cursor, record_length, record) == -1)
+            {
+                cursor_close(&cursor);
+                return -1;
+            }
+            if (record[0] == 0xFF || (t = hist_timestamp_clock(&sc, record)) <= last_time)
+                break;
+            last_time = t;
+            next++;
+            if (++i == window)
+            {
+                store_records(out, fileptr, &store_clock, o_count, data, i, next - i);
+                i = 0;
+            }
+        }
+        cursor_close(&cursor);
+        store_records(out, fileptr, &store_clock, o_count, data, i, next - i);
+        stored = next - first;
+    }
+
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", statefile);
+    if ((stateptr = fopen(tmpname, "w")) == NULL)
+        return -1;
+    fprintf(stateptr, "%d %ld %d\n", next, last_time, record_length);
+    fclose(stateptr);
+    if (rename(tmpname, statefile) < 0)
+        return -1;
+
+    return stored;
+}
+
+
+/********************************************************************
+ * export_history writes records to a columnar export file, either a
+ * record range read from the station or a whole -a archive
+ *
+ * Input:   ws - handle to the weatherstation, NULL for an archive
+ *          filename - export file
+ *          args - remaining arguments: start and end record, or the
+ *                 archive file
+ *
+ * Returns: number of records exported, -1 on error
+ *
+ ********************************************************************/
+static int export_history(WEATHERSTATION ws, char *filename, char *args[])
+{
+    FILE *fileptr;
+    struct packed_record *records = NULL;
+    struct station_clock sc;
+    unsigned char data[32768];
+    int count = 0, allocated = 0, channels = 1;
+    int o_count, start_rec, end_rec, i, ret;
+
+    if (ws == NULL)
+    {
+        // Archive: read it whole, the channels are those ever valid
+        if ((fileptr = fopen(args[0], "rb")) == NULL)
+            return -1;
+        do
+        {
+            if (count == allocated)
+            {
+                struct packed_record *grown;
+
+                allocated = allocated ? 2 * allocated : 4096;
+                if ((grown = realloc(records, allocated * sizeof(*records))) == NULL)
+                {
+                    free(records);
+                    fclose(fileptr);
+                    return -1;
+                }
+                records = grown;
+            }
+            i = read_packed_records(fileptr, records + count, allocated - count);
+            count += i;
+        } while (i > 0);
+        fclose(fileptr);
+
+        for (i = 0; i < count; i++)
+            while (channels < 4 && (records[i].valid & (PACKED_TEMP_VALID(channels) |
+                                                        PACKED_RH_VALID(channels))))
+                channels++;
+    }
+    else
+    {
+        start_rec = strtol(args[0], NULL, 10);
+        end_rec = strtol(args[1], NULL, 10);
+        if ((o_count = outdoor_count(ws)) == -1)
+            return -1;
+        if (start_rec < 0 || start_rec >= end_rec ||
+            end_rec >= get_history_record_max(o_count))
+        {
+            printf("Record range invalid\n");
+            return -1;
+        }
+
+        count = end_rec - start_rec + 1;
+        if ((records = malloc(count * sizeof(*records))) == NULL)
+            return -1;
+        if (read_safe(ws, HISTORY_BUFFER_ADR + start_rec * get_history_record_length(o_count),
+                      count * get_history_record_length(o_count), data) == -1)
+        {
+            free(records);
+            return -1;
+        }
+        station_clock_init(&sc, 1);
+        decode_packed_records(get_record_layout(o_count), data, count, &sc, records);
+        channels = get_record_layout(o_count)->channels;
+    }
+
+    if ((fileptr = fopen(filename, "wb")) == NULL)
+    {
+        free(records);
+        return -1;
+    }
+    ret = export_columns(fileptr, records, count, channels);
+    if (fclose(fileptr) != 0)
+        ret = -1;
+    free(records);
+
+    return ret == 0 ? count : -1;
+}
+
+
 /********** MAIN PROGRAM ************************************************
  *
  * This program reads the history records from a WS8610
@@ -52,10 +428,12 @@ int main(int argc, char *argv[])
     WEATHERSTATION ws;
     FILE *fileptr;
     unsigned char data[32768];
+    static struct packed_record packed[HISTORY_BUFFER_SIZE / 10];
+    static struct sink out;
+    struct station_clock sc;
     int o_count;
-    int i, j, rec_count;
+    int rec_count;
     int start_rec, end_rec, start_adr, end_adr;
-    struct config_type config;
 
     // Get in-data and select mode.
 
@@ -65,7 +443,16 @@ int main(int argc, char *argv[])
 
     get_configuration(&config, "");
 
-    if (argc!=4)
+    if (argc == 4 && strcmp(argv[1], "-c") == 0)
+    {
+        if ((rec_count = export_history(NULL, argv[2], argv + 3)) == -1)
+            printf("Cannot export archive %s\n", argv[3]);
+        else
+            printf("%d records exported\n", rec_count);
+        return(0);
+    }
+
+    if (argc != 4 && !(argc == 5 && strcmp(argv[1], "-c") == 0))
     {
         print_usage();
         exit(0);
@@ -74,6 +461,45 @@ int main(int argc, char *argv[])
     // Setup serial port
     ws = open_weatherstation(config.serial_device_name);
 
+    if (strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "-a") == 0)
+    {
+        fileptr = fopen(argv[2], argv[1][1] == 'a' ? "ab" : "a");
+        if (fileptr == NULL)
+        {
+            printf("Cannot open file %s\n",argv[2]);
+            exit(0);
+        }
+        if (argv[1][1] == 'a')
+            rec_count = sync_history(ws, NULL, fileptr, argv[3]);
+        else
+        {
+            // Text is echoed to stdout, a CSV header starts a new file
+            fseek(fileptr, 0, SEEK_END);
+            sink_open(&out, config.output_format, ftell(fileptr) == 0);
+            sink_add_fd(&out, STDOUT_FILENO);
+            sink_add_fd(&out, fileno(fileptr));
+            rec_count = sync_history(ws, &out, fileptr, argv[3]);
+            if (sink_close(&out) == -1)
+                rec_count = -1;
+        }
+        if (rec_count == -1)
+            printf("\nError reading data\n");
+        else
+            printf("%d new records\n", rec_count);
+        close_weatherstation(ws);
+        fclose(fileptr);
+        return(0);
+    }
+
+    if (argc == 5)
+    {
+        if ((rec_count = export_history(ws, argv[2], argv + 3)) == -1)
+            printf("\nError exporting data\n");
+        else
+            printf("%d records exported\n", rec_count);
+        close_weatherstation(ws);
+        return(0);
+    }
 
     fileptr = fopen(argv[1], "w");
     if (fileptr == NULL)
@@ -100,6 +526,14 @@ int main(int argc, char *argv[])
         exit(0);
     }
 
+    if (end_rec >= get_history_record_max(o_count))
+    {
+        printf("Record range invalid\n");
+        close_weatherstation(ws);
+        fclose(fileptr);
+        exit(0);
+    }
+
     start_adr = start_rec * get_history_record_length(o_count) + HISTORY_BUFFER_ADR;
     end_adr = end_rec * get_history_record_length(o_count) + HISTORY_BUFFER_ADR + get_history_record_length(o_count) - 1;
 
@@ -111,20 +545,15 @@ int main(int argc, char *argv[])
     }
 
     // Write out the data
-    rec_count = start_rec;
-    for (i=0; i<=end_adr-start_adr; i+=get_history_record_length(o_count))
-    {
-        printf("Record %04i ",rec_count);
-        fprintf(fileptr,"Record %04i ",rec_count);
-        for (j = 0; j < get_history_record_length(o_count); j++)
-        {
-            printf("%02X ",data[i + j]);
-            fprintf(fileptr,"%02X ",data[i + j]);
-        }
-        rec_count++;
-        printf("\n");
-        fprintf(fileptr,"\n");
-    }
+    station_clock_init(&sc, 1);
+    decode_packed_records(get_record_layout(o_count), data, end_rec - start_rec + 1,
+                          &sc, packed);
+    sink_open(&out, config.output_format, 1);
+    sink_add_fd(&out, STDOUT_FILENO);
+    sink_add_fd(&out, fileno(fileptr));
+    write_records(&out, get_record_layout(o_count), data, packed,
+                  end_rec - start_rec + 1, start_rec);
+    sink_close(&out);
 
     // Goodbye and Goodnight
     close_weatherstation(ws);
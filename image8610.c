@@ -0,0 +1,230 @@
+/*  open8610  - image8610 station image functions
+ *  This file contains the writer for station image files and a
+ *  transport that serves read_safe() from a memory mapped image,
+ *  so all tools can reprocess captured data without serial I/O.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "image8610.h"
+#include <sys/mman.h>
+
+struct image_state
+{
+    unsigned char *map;
+    size_t size;
+    struct image_header *header;
+    unsigned char *memory;
+};
+
+
+/********************************************************************
+ * image_write
+ * Writes a station image file
+ *
+ * Input:   filename - file to create
+ *          memory - IMAGE_MEMORY_SIZE bytes of station memory, only
+ *                   the bytes inside ranges need to be valid
+ *          ranges - address ranges read from the station
+ *          range_count - number of ranges, max IMAGE_MAX_RANGES
+ *          capture_time - time the memory was read
+ *          outdoor_count - count of additional outdoor sensors
+ *
+ * Returns: 0 on success, -1 on error
+ *
+ ********************************************************************/
+int image_write(char *filename, unsigned char *memory,
+                struct image_range *ranges, int range_count,
+                time_t capture_time, int outdoor_count)
+{
+    unsigned char header[IMAGE_HEADER_SIZE];
+    struct image_header *h = (struct image_header *)header;
+    FILE *fileptr;
+    int ok;
+
+    if (range_count > IMAGE_MAX_RANGES)
+        return -1;
+
+    memset(header, 0, sizeof(header));
+    memcpy(h->magic, IMAGE_MAGIC, sizeof(h->magic));
+    h->version = IMAGE_VERSION;
+    h->header_size = IMAGE_HEADER_SIZE;
+    h->capture_time = capture_time;
+    h->outdoor_count = outdoor_count;
+    h->range_count = range_count;
+    memcpy(h->range, ranges, range_count * sizeof(*ranges));
+
+    if ((fileptr = fopen(filename, "wb")) == NULL)
+        return -1;
+    ok = fwrite(header, sizeof(header), 1, fileptr) == 1 &&
+         fwrite(memory, IMAGE_MEMORY_SIZE, 1, fileptr) == 1;
+    if (fclose(fileptr) != 0)
+        ok = 0;
+
+    return ok ? 0 : -1;
+}
+
+/********************************************************************
+ * image_header
+ * Gives access to the header of an opened image
+ *
+ * Input:   ws - handle to a station opened on the image transport
+ *
+ * Returns: pointer to the header
+ *
+ ********************************************************************/
+struct image_header *image_header(WEATHERSTATION ws)
+{
+    return ((struct image_state *)ws->transport_data)->header;
+}
+
+
+/********************************************************************
+ * image_open, image transport
+ * Maps an image file and checks its header
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *          device - image file name
+ *
+ * Returns: 0 on success, -1 if the file is no valid image
+ *
+ ********************************************************************/
+static int image_open(WEATHERSTATION ws, char *device)
+{
+    struct image_state *image;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(device, O_RDONLY)) < 0)
+    {
+        printf("\nUnable to open station image %s\n", device);
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < IMAGE_HEADER_SIZE + IMAGE_MEMORY_SIZE ||
+        (image = calloc(1, sizeof(*image))) == NULL)
+    {
+        printf("\nInvalid station image %s\n", device);
+        close(fd);
+        return -1;
+    }
+
+    image->size = st.st_size;
+    image->map = mmap(NULL, image->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image->map == MAP_FAILED)
+    {
+        perror("image_open");
+        free(image);
+        return -1;
+    }
+
+    // The file is at least IMAGE_HEADER_SIZE + IMAGE_MEMORY_SIZE long,
+    // so the size check of header_size cannot wrap around
+    image->header = (struct image_header *)image->map;
+    if (memcmp(image->header->magic, IMAGE_MAGIC, sizeof(image->header->magic)) != 0 ||
+        image->header->version != IMAGE_VERSION ||
+        image->header->header_size < sizeof(struct image_header) ||
+        image->header->header_size > image->size - IMAGE_MEMORY_SIZE ||
+        image->header->range_count > IMAGE_MAX_RANGES)
+    {
+        printf("\nInvalid station image %s\n", device);
+        munmap(image->map, image->size);
+        free(image);
+        return -1;
+    }
+    image->memory = image->map + image->header->header_size;
+
+    ws->transport_data = image;
+    return 0;
+}
+
+static void image_close(WEATHERSTATION ws)
+{
+    struct image_state *image = ws->transport_data;
+
+    munmap(image->map, image->size);
+    free(image);
+    ws->transport_data = NULL;
+}
+
+/********************************************************************
+ * image_read_block, image transport
+ * Serves read_safe() from the image. Reads touching memory that was
+ * not captured fail like a read the station never answered.
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *          address - first address
+ *          number - number of bytes
+ *          zeros - unused, an image has no link to go dead
+ *
+ * Output:  readdata - the bytes read
+ *
+ * Returns: number of bytes read, -1 if the range was not captured
+ *
+ ********************************************************************/
+static int image_read_block(WEATHERSTATION ws, int address, int number,
+                            unsigned char *readdata, int zeros)
+{
+    struct image_state *image = ws->transport_data;
+    struct image_header *h = image->header;
+    uint32_t i;
+    int n;
+
+    // Addresses wrap around like in the station
+    address &= IMAGE_MEMORY_SIZE - 1;
+    if (address + number > IMAGE_MEMORY_SIZE)
+    {
+        n = IMAGE_MEMORY_SIZE - address;
+        if (image_read_block(ws, address, n, readdata, zeros) == -1 ||
+            image_read_block(ws, 0, number - n, readdata + n, zeros) == -1)
+            return -1;
+        return number;
+    }
+
+    for (i = 0; i < h->range_count; i++)
+    {
+        if (address >= (int)h->range[i].start &&
+            address + number <= (int)(h->range[i].start + h->range[i].length))
+        {
+            memcpy(readdata, image->memory + address, number);
+            ws->stats.line_bytes += number;
+            return number;
+        }
+    }
+
+    return -1;
+}
+
+static void image_set_line(WEATHERSTATION ws, int val)
+{
+}
+
+static int image_get_line(WEATHERSTATION ws)
+{
+    return 0;
+}
+
+static int image_read_device(WEATHERSTATION ws, unsigned char *buffer, int size)
+{
+    return 0;
+}
+
+static int image_write_device(WEATHERSTATION ws, unsigned char *buffer, int size)
+{
+    return size;
+}
+
+const struct transport8610 image_transport = {
+    "image",
+    image_open,
+    image_close,
+    image_set_line,
+    image_set_line,
+    image_get_line,
+    image_get_line,
+    image_read_device,
+    image_write_device,
+    image_read_block,
+    NULL,
+    NULL
+};
@@ -0,0 +1,45 @@
+/* Include file for the open8610 station image functions
+ *
+ * A station image is a binary capture of the 32 KB station memory with
+ * a header telling when it was taken and which address ranges hold
+ * data actually read from the station. Open one by setting the device
+ * name to image:filename, all reads are then served from the file.
+ */
+
+#ifndef _INCLUDE_IMAGE8610_H_
+#define _INCLUDE_IMAGE8610_H_
+
+#include "rw8610.h"
+#include <stdint.h>
+
+#define IMAGE_MAGIC         "WS8610IM"
+#define IMAGE_VERSION       1
+#define IMAGE_MEMORY_SIZE   0x8000
+#define IMAGE_MAX_RANGES    32
+#define IMAGE_HEADER_SIZE   512     // memory starts at this file offset
+
+struct image_range
+{
+    uint32_t start;
+    uint32_t length;
+};
+
+struct image_header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    int64_t  capture_time;          // seconds since 1/1/70
+    int32_t  outdoor_count;
+    uint32_t range_count;
+    struct image_range range[IMAGE_MAX_RANGES];
+};
+
+extern const struct transport8610 image_transport;
+
+int image_write(char *filename, unsigned char *memory,
+                struct image_range *ranges, int range_count,
+                time_t capture_time, int outdoor_count);
+struct image_header *image_header(WEATHERSTATION ws);
+
+#endif /* _INCLUDE_IMAGE8610_H_ */
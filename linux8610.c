@@ -14,80 +14,86 @@
 #define DEBUG 0
 
 #include "rw8610.h"
+#include "sim8610.h"
+#include "image8610.h"
+#include "daemon8610.h"
 #include <time.h>
+#include <signal.h>
+#include <sys/time.h>
+
+static long long timespec_diff_ns(struct timespec *a, struct timespec *b);
+static long long wait_DSR(WEATHERSTATION ws, int level);
+
+/* Transports selectable by a "prefix:" in the device name */
+static const struct transport8610 *transports[] = {
+    &sim_transport,
+    &image_transport,
+    &unix_transport,
+    NULL
+};
 
 /********************************************************************
- * open_weatherstation, Windows version
+ * try_open_weatherstation, Linux version
+ * Opens the station like open_weatherstation() but returns on failure,
+ * for a program that keeps running and tries again later
  *
- * Input:   devicename (COM1, COM2 etc)
+ * Input:   devicename, see open_weatherstation()
  *
- * Returns: Handle to the weatherstation (type WEATHERSTATION)
+ * Returns: Handle to the weatherstation (type WEATHERSTATION), NULL
+ *          on failure with errno ETIMEDOUT if the station did not
+ *          answer the handshake
  *
  ********************************************************************/
-WEATHERSTATION open_weatherstation (char *device)
+WEATHERSTATION try_open_weatherstation(char *device)
 {
     WEATHERSTATION ws;
-    struct termios adtio;
     unsigned char buffer[BUFFER_SIZE];
+    struct timespec start, end;
     long i;
-    print_log(1,"open_weatherstation");
+    LOG(1, "open_weatherstation");
 
-    //Setup serial port
-    if ((ws = open(device, O_RDWR | O_NOCTTY)) < 0)
+    recorder_init(config.flight_file);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if ((ws = calloc(1, sizeof(*ws))) == NULL)
     {
-        printf("\nUnable to open serial device %s\n", device);
-        exit(EXIT_FAILURE);
+        perror("open_weatherstation");
+        return NULL;
     }
-
-    if ( flock(ws, LOCK_EX) < 0 ) {
-        perror("\nSerial device is locked by other program\n");
-        exit(EXIT_FAILURE);
+    ws->fd = -1;
+    ws->mismatch_rate = VERIFY_RATE_START;
+    ws->transport = &serial_transport;
+    for (i = 0; transports[i] != NULL; i++)
+    {
+        size_t len = strlen(transports[i]->prefix);
+
+        if (strncmp(device, transports[i]->prefix, len) == 0 && device[len] == ':')
+        {
+            ws->transport = transports[i];
+            device += len + 1;
+            break;
+        }
     }
-    //We want full control of what is set and simply reset the entire adtio struct
-    memset(&adtio, 0, sizeof(adtio));
-    // Serial control options
-    adtio.c_cflag &= ~PARENB;      // No parity
-    adtio.c_cflag &= ~CSTOPB;      // One stop bit
-    adtio.c_cflag &= ~CSIZE;       // Character size mask
-    adtio.c_cflag |= CS8;          // Character size 8 bits
-    adtio.c_cflag |= CREAD;        // Enable Receiver
-    //adtio.c_cflag &= ~CREAD;        // Disable Receiver
-    adtio.c_cflag &= ~HUPCL;       // No "hangup"
-    adtio.c_cflag &= ~CRTSCTS;     // No flowcontrol
-    adtio.c_cflag |= CLOCAL;       // Ignore modem control lines
-
-    // Baudrate, for newer systems
-    cfsetispeed(&adtio, BAUDRATE);
-    cfsetospeed(&adtio, BAUDRATE);
-
-    // Serial local options: adtio.c_lflag
-    // Raw input = clear ICANON, ECHO, ECHOE, and ISIG
-    // Disable misc other local features = clear FLUSHO, NOFLSH, TOSTOP, PENDIN, and IEXTEN
-    // So we actually clear all flags in adtio.c_lflag
-    adtio.c_lflag = 0;
 
-    // Serial input options: adtio.c_iflag
-    // Disable parity check = clear INPCK, PARMRK, and ISTRIP
-    // Disable software flow control = clear IXON, IXOFF, and IXANY
-    // Disable any translation of CR and LF = clear INLCR, IGNCR, and ICRNL
-    // Ignore break condition on input = set IGNBRK
-    // Ignore parity errors just in case = set IGNPAR;
-    // So we can clear all flags except IGNBRK and IGNPAR
-    adtio.c_iflag = IGNBRK|IGNPAR;
-
-    // Serial output options
-    // Raw output should disable all other output options
-    adtio.c_oflag &= ~OPOST;
-
-    adtio.c_cc[VTIME] = 10;		// timer 1s
-    adtio.c_cc[VMIN] = 0;		// blocking read until 1 char
+    if (ws->transport->open(ws, device) < 0)
+    {
+        free(ws);
+        errno = 0;
+        return NULL;
+    }
 
-    if (tcsetattr(ws, TCSANOW, &adtio) < 0)
+    if (ws->transport->read_block != NULL)
     {
-        printf("Unable to initialize serial device");
-        exit(0);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ws->connect_ns = timespec_diff_ns(&end, &start);
+        ws->stats.connects = 1;
+        ws->stats.connect_ns = ws->connect_ns;
+        return ws;
     }
-    tcflush(ws, TCIOFLUSH);
+
+    if (spins_per_ns == 0)
+        calibrate();
 
     for (i = 0; i < 448; i++) {
         buffer[i] = 'U';
@@ -97,34 +103,57 @@ WEATHERSTATION open_weatherstation (char *device)
 
     set_DTR(ws,0);
     set_RTS(ws,0);
-    i = 0;
-    do {
-        sleep_short(10);
-        i++;
-    } while (i < INIT_WAIT && !get_DSR(ws));
-    if (i == INIT_WAIT)
+    if ((ws->dsr_rise_ns = wait_DSR(ws, 1)) < 0)
     {
-        print_log(2,"Connection timeout 1");
+        LOG(2, "Connection timeout 1");
         printf ("Connection timeout\n");
         close_weatherstation(ws);
-        exit(0);
+        errno = ETIMEDOUT;
+        return NULL;
     }
-    i = 0;
-    do {
-        sleep_short(10);
-        i++;
-    } while (i < INIT_WAIT && get_DSR(ws));
-    if (i != INIT_WAIT) {
+    if ((ws->dsr_fall_ns = wait_DSR(ws, 0)) >= 0) {
         set_RTS(ws,1);
         set_DTR(ws,1);
     } else
     {
-        print_log(2,"Connection timeout 2");
+        LOG(2, "Connection timeout 2");
         printf ("Connection timeout\n");
         close_weatherstation(ws);
-        exit(0);
+        errno = ETIMEDOUT;
+        return NULL;
     }
     write_device(ws, buffer, 448);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ws->connect_ns = timespec_diff_ns(&end, &start);
+    ws->stats.connects = 1;
+    ws->stats.connect_ns = ws->connect_ns;
+    ws->stats.handshake_ns = ws->dsr_rise_ns + ws->dsr_fall_ns;
+    LOG(1, "open_weatherstation - connected in %.1f ms, station %.1f ms "
+        "(DSR up %.1f ms, down %.1f ms), host %.1f ms",
+        ws->connect_ns / 1e6, (ws->dsr_rise_ns + ws->dsr_fall_ns) / 1e6,
+        ws->dsr_rise_ns / 1e6, ws->dsr_fall_ns / 1e6,
+        (ws->connect_ns - ws->dsr_rise_ns - ws->dsr_fall_ns) / 1e6);
+    return ws;
+}
+
+/********************************************************************
+ * open_weatherstation, Linux version
+ *
+ * Input:   devicename (/dev/ttyS0, /dev/ttyS1 etc, sim:memmapfile
+ *          for the in-process station simulator or image:imagefile
+ *          for a captured station image)
+ *
+ * Returns: Handle to the weatherstation (type WEATHERSTATION), exits
+ *          the program if the station cannot be opened
+ *
+ ********************************************************************/
+WEATHERSTATION open_weatherstation(char *device)
+{
+    WEATHERSTATION ws;
+
+    if ((ws = try_open_weatherstation(device)) == NULL)
+        exit(errno == ETIMEDOUT ? 0 : EXIT_FAILURE);
     return ws;
 }
 
@@ -139,50 +168,73 @@ WEATHERSTATION open_weatherstation (char *device)
  ********************************************************************/
 void close_weatherstation(WEATHERSTATION ws)
 {
-    tcflush(ws,TCIOFLUSH);
-    close(ws);
+    ws->transport->close(ws);
+    free(ws);
     return;
 }
 
 /********************************************************************
- * set_DTR
- * Sets or resets DTR signal
+ * set_line
+ * Sets or resets a modem output line through the transport. The
+ * output lines are shadowed so a line already at the requested level
+ * costs no ioctl at all.
  *
- * Inputs:  serdevice - opened file handle
+ * Inputs:  ws - handle to the weatherstation
+ *          line - TIOCM_DTR or TIOCM_RTS
  *          val - value to set
  *
  * Returns nothing
  *
  ********************************************************************/
-
-void set_DTR(WEATHERSTATION ws, int val)
+static void set_line(WEATHERSTATION ws, int line, int val)
 {
-    //TODO: use TIOCMBIC and TIOCMBIS instead of TIOCMGET and TIOCMSET
-    int portstatus;
-    ioctl(ws, TIOCMGET, &portstatus);	// get current port status
-    if (val)
+    if (line == TIOCM_DTR)
+        LOG_TRACE(5, TRACE_SET_DTR, val);
+    else
+        LOG_TRACE(5, TRACE_SET_RTS, val);
+
+    if (ws->lines_valid && ((ws->lines & line) != 0) == (val != 0))
+        return;
+
+    if (line == TIOCM_DTR)
     {
-        print_log(5,"Set DTR");
-        portstatus |= TIOCM_DTR;
+        recorder_event(EVENT_SET_DTR, val != 0, 0);
+        ws->transport->set_DTR(ws, val);
     }
     else
     {
-        print_log(5,"Clear DTR");
-        portstatus &= ~TIOCM_DTR;
+        recorder_event(EVENT_SET_RTS, val != 0, 0);
+        ws->transport->set_RTS(ws, val);
     }
-    ioctl(ws, TIOCMSET, &portstatus);	// set current port status
+    ws->stats.ioctls++;
 
-    /*if (val)
-      ioctl(ws, TIOCMBIS, TIOCM_DTR);
+    if (val)
+        ws->lines |= line;
     else
-      ioctl(ws, TIOCMBIC, TIOCM_DTR);*/
+        ws->lines &= ~line;
+}
+
+/********************************************************************
+ * set_DTR
+ * Sets or resets DTR signal
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *          val - value to set
+ *
+ * Returns nothing
+ *
+ ********************************************************************/
+
+void set_DTR(WEATHERSTATION ws, int val)
+{
+    set_line(ws, TIOCM_DTR, val);
 }
 
 /********************************************************************
  * set_RTS
  * Sets or resets RTS signal
  *
- * Inputs:  serdevice - opened file handle,
+ * Inputs:  ws - handle to the weatherstation
  *          val - value to set
  *
  * Returns nothing
@@ -191,34 +243,14 @@ void set_DTR(WEATHERSTATION ws, int val)
 
 void set_RTS(WEATHERSTATION ws, int val)
 {
-    //TODO: use TIOCMBIC and TIOCMBIS instead of TIOCMGET and TIOCMSET
-    int portstatus;
-    ioctl(ws, TIOCMGET, &portstatus);	// get current port status
-    if (val)
-    {
-        print_log(5,"Set RTS");
-        portstatus |= TIOCM_RTS;
-    }
-    else
-    {
-        print_log(5,"Clear RTS");
-        portstatus &= ~TIOCM_RTS;
-    }
-    ioctl(ws, TIOCMSET, &portstatus);	// set current port status
-
-    /*if (val)
-      ioctl(ws, TIOCMBIS, TIOCM_RTS);
-    else
-      ioctl(ws, TIOCMBIC, TIOCM_RTS);
-    */
-
+    set_line(ws, TIOCM_RTS, val);
 }
 
 /********************************************************************
  * get_DSR
  * Checks status of DSR signal
  *
- * Inputs:  ws - opened file handle
+ * Inputs:  ws - handle to the weatherstation
  *
  *
  * Returns: status of DSR signal
@@ -227,26 +259,20 @@ void set_RTS(WEATHERSTATION ws, int val)
 
 int get_DSR(WEATHERSTATION ws)
 {
-    int portstatus;
-    ioctl(ws, TIOCMGET, &portstatus);	// get current port status
+    int status;
 
-    if (portstatus & TIOCM_DSR)
-    {
-        print_log(5,"Got DSR = 1");
-        return 1;
-    }
-    else
-    {
-        print_log(5,"Got DSR = 0");
-        return 0;
-    }
+    ws->stats.ioctls++;
+    status = ws->transport->get_DSR(ws) != 0;
+    recorder_event(EVENT_GET_DSR, status, 0);
+    LOG_TRACE(5, TRACE_GET_DSR, status);
+    return status;
 }
 
 /********************************************************************
  * get_CTS
  * Checks status of CTS signal
  *
- * Inputs:  ws - opened file handle
+ * Inputs:  ws - handle to the weatherstation
  *
  *
  * Returns: status of CTS signal
@@ -255,27 +281,305 @@ int get_DSR(WEATHERSTATION ws)
 
 int get_CTS(WEATHERSTATION ws)
 {
-    int portstatus;
-    ioctl(ws, TIOCMGET, &portstatus);	// get current port status
+    int status;
+
+    ws->stats.ioctls++;
+    status = ws->transport->get_CTS(ws) != 0;
+    recorder_event(EVENT_GET_CTS, status, 0);
+    LOG_TRACE(5, TRACE_GET_CTS, status);
+    return status;
+}
+
+
+/********************************************************************
+ * wait_DSR
+ * Waits for the DSR signal to reach a level. Transports that can
+ * sleep until the line changes are used for that, otherwise DSR is
+ * polled every INIT_POLL_MS.
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *          level - DSR level to wait for
+ *
+ * Returns: time waited in ns, -1 on timeout after INIT_WAIT polls
+ *
+ ********************************************************************/
+static long long wait_DSR(WEATHERSTATION ws, int level)
+{
+    struct timespec start, now;
+    long timeout_ms = INIT_WAIT * INIT_POLL_MS;
+    long long waited;
+    int ret = -1;
 
-    if (portstatus & TIOCM_CTS)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ws->transport->wait_DSR != NULL)
+        ret = ws->transport->wait_DSR(ws, level, timeout_ms);
+
+    if (ret < 0)
     {
-        print_log(5,"Got CTS = 1");
-        return 1;
+        // Poll for whatever is left of the timeout
+        while (get_DSR(ws) != level)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (timespec_diff_ns(&now, &start) >= timeout_ms * 1000000LL)
+                return -1;
+            sleep_short(INIT_POLL_MS);
+        }
+        ret = 1;
     }
-    else
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    waited = timespec_diff_ns(&now, &start);
+    return ret ? waited : -1;
+}
+
+/********************************************************************
+ * read_device reads raw bytes through the transport
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *          buffer - pointer to the buffer to read into (unsigned char)
+ *          size - number of bytes to read
+ *
+ * Output:  *buffer - modified on success (pointer to unsigned char)
+ *
+ * Returns: number of bytes read
+ *
+ ********************************************************************/
+int read_device(WEATHERSTATION ws, unsigned char *buffer, int size)
+{
+    return ws->transport->read_device(ws, buffer, size);
+}
+
+/********************************************************************
+ * write_device writes raw bytes through the transport
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *          buffer - pointer to the buffer to write from
+ *          size - number of bytes to write
+ *
+ * Returns: number of bytes written
+ *
+ ********************************************************************/
+int write_device(WEATHERSTATION ws, unsigned char *buffer, int size)
+{
+    return ws->transport->write_device(ws, buffer, size);
+}
+
+
+/********************************************************************
+ * serial_open, serial transport
+ * Opens and configures the serial port
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *          device - serial device name
+ *
+ * Returns: 0 on success, -1 if the port could not be set up
+ *
+ ********************************************************************/
+static int serial_open(WEATHERSTATION ws, char *device)
+{
+    struct termios adtio;
+
+    //Setup serial port
+    if ((ws->fd = open(device, O_RDWR | O_NOCTTY)) < 0)
     {
-        print_log(5,"Got CTS = 0");
-        return 0;
+        printf("\nUnable to open serial device %s\n", device);
+        return -1;
     }
+
+    if ( flock(ws->fd, LOCK_EX) < 0 ) {
+        perror("\nSerial device is locked by other program\n");
+        close(ws->fd);
+        return -1;
+    }
+    //We want full control of what is set and simply reset the entire adtio struct
+    memset(&adtio, 0, sizeof(adtio));
+    // Serial control options
+    adtio.c_cflag &= ~PARENB;      // No parity
+    adtio.c_cflag &= ~CSTOPB;      // One stop bit
+    adtio.c_cflag &= ~CSIZE;       // Character size mask
+    adtio.c_cflag |= CS8;          // Character size 8 bits
+    adtio.c_cflag |= CREAD;        // Enable Receiver
+    //adtio.c_cflag &= ~CREAD;        // Disable Receiver
+    adtio.c_cflag &= ~HUPCL;       // No "hangup"
+    adtio.c_cflag &= ~CRTSCTS;     // No flowcontrol
+    adtio.c_cflag |= CLOCAL;       // Ignore modem control lines
+
+    // Baudrate, for newer systems
+    cfsetispeed(&adtio, BAUDRATE);
+    cfsetospeed(&adtio, BAUDRATE);
+
+    // Serial local options: adtio.c_lflag
+    // Raw input = clear ICANON, ECHO, ECHOE, and ISIG
+    // Disable misc other local features = clear FLUSHO, NOFLSH, TOSTOP, PENDIN, and IEXTEN
+    // So we actually clear all flags in adtio.c_lflag
+    adtio.c_lflag = 0;
+
+    // Serial input options: adtio.c_iflag
+    // Disable parity check = clear INPCK, PARMRK, and ISTRIP
+    // Disable software flow control = clear IXON, IXOFF, and IXANY
+    // Disable any translation of CR and LF = clear INLCR, IGNCR, and ICRNL
+    // Ignore break condition on input = set IGNBRK
+    // Ignore parity errors just in case = set IGNPAR;
+    // So we can clear all flags except IGNBRK and IGNPAR
+    adtio.c_iflag = IGNBRK|IGNPAR;
+
+    // Serial output options
+    // Raw output should disable all other output options
+    adtio.c_oflag &= ~OPOST;
+
+    adtio.c_cc[VTIME] = 10;		// timer 1s
+    adtio.c_cc[VMIN] = 0;		// blocking read until 1 char
+
+    if (tcsetattr(ws->fd, TCSANOW, &adtio) < 0)
+    {
+        printf("Unable to initialize serial device");
+        close(ws->fd);
+        return -1;
+    }
+    tcflush(ws->fd, TCIOFLUSH);
+
+    // Seed the shadow of the output lines from the port
+    if (ioctl(ws->fd, TIOCMGET, &ws->lines) == 0)
+        ws->lines_valid = 1;
+    ws->stats.ioctls++;
+
+    return 0;
+}
+
+/********************************************************************
+ * serial_close, serial transport
+ *
+ * Input: Handle to the weatherstation (type WEATHERSTATION)
+ *
+ * Returns nothing
+ *
+ ********************************************************************/
+static void serial_close(WEATHERSTATION ws)
+{
+    tcflush(ws->fd,TCIOFLUSH);
+    close(ws->fd);
+}
+
+/********************************************************************
+ * serial_set_DTR, serial_set_RTS, serial transport
+ * Sets or resets a modem output line with a single ioctl
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *          val - value to set
+ *
+ * Returns nothing
+ *
+ ********************************************************************/
+static void serial_set_DTR(WEATHERSTATION ws, int val)
+{
+    int bits = TIOCM_DTR;
+
+    ioctl(ws->fd, val ? TIOCMBIS : TIOCMBIC, &bits);
 }
 
+static void serial_set_RTS(WEATHERSTATION ws, int val)
+{
+    int bits = TIOCM_RTS;
+
+    ioctl(ws->fd, val ? TIOCMBIS : TIOCMBIC, &bits);
+}
+
+/********************************************************************
+ * serial_get_DSR, serial_get_CTS, serial transport
+ * Checks status of a modem input line
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *
+ * Returns: status of the signal
+ *
+ ********************************************************************/
+static int serial_get_DSR(WEATHERSTATION ws)
+{
+    int portstatus = 0;
+    ioctl(ws->fd, TIOCMGET, &portstatus);	// get current port status
+
+    return (portstatus & TIOCM_DSR) != 0;
+}
+
+static int serial_get_CTS(WEATHERSTATION ws)
+{
+    int portstatus = 0;
+    ioctl(ws->fd, TIOCMGET, &portstatus);	// get current port status
+
+    return (portstatus & TIOCM_CTS) != 0;
+}
+
+/* SIGALRM only has to interrupt TIOCMIWAIT */
+static void serial_alarm(int sig)
+{
+}
 
 /********************************************************************
- * read_device in the Linux version is identical
+ * serial_wait_DSR, serial transport
+ * Sleeps in TIOCMIWAIT until DSR changes instead of polling it. An
+ * interval timer interrupts the wait every DSR_RECHECK_MS so the line
+ * is read again, which covers both the timeout and an edge that came
+ * between reading DSR and starting the wait.
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *          level - DSR level to wait for
+ *          timeout_ms - give up after this many milliseconds
+ *
+ * Returns: 1 when DSR reached level, 0 on timeout, -1 if the driver
+ *          does not support TIOCMIWAIT
+ *
+ ********************************************************************/
+static int serial_wait_DSR(WEATHERSTATION ws, int level, long timeout_ms)
+{
+#ifdef TIOCMIWAIT
+    struct sigaction sa, old_sa;
+    struct itimerval timer, old_timer;
+    struct timespec start, now;
+    int ret;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serial_alarm;       // no SA_RESTART, the ioctl must return
+    sigaction(SIGALRM, &sa, &old_sa);
+    timer.it_value.tv_sec = 0;
+    timer.it_value.tv_usec = DSR_RECHECK_MS * 1000;
+    timer.it_interval = timer.it_value;
+    setitimer(ITIMER_REAL, &timer, &old_timer);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;)
+    {
+        if (serial_get_DSR(ws) == level)
+        {
+            ret = 1;
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (timespec_diff_ns(&now, &start) >= timeout_ms * 1000000LL)
+        {
+            ret = 0;
+            break;
+        }
+        ws->stats.ioctls += 2;
+        if (ioctl(ws->fd, TIOCMIWAIT, TIOCM_DSR) < 0 && errno != EINTR)
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    setitimer(ITIMER_REAL, &old_timer, NULL);
+    sigaction(SIGALRM, &old_sa, NULL);
+    return ret;
+#else
+    return -1;
+#endif
+}
+
+/********************************************************************
+ * serial_read_device in the Linux version is identical
  * to the standard Linux read()
  *
- * Inputs:  serdevice - opened file handle
+ * Inputs:  ws - handle to the weatherstation
  *          buffer - pointer to the buffer to read into (unsigned char)
  *          size - number of bytes to read
  *
@@ -284,12 +588,12 @@ int get_CTS(WEATHERSTATION ws)
  * Returns: number of bytes read
  *
  ********************************************************************/
-int read_device(WEATHERSTATION ws, unsigned char *buffer, int size)
+static int serial_read_device(WEATHERSTATION ws, unsigned char *buffer, int size)
 {
     int ret;
 
     for (;;) {
-        ret = read(ws, buffer, size);
+        ret = read(ws->fd, buffer, size);
         if (ret == 0 && errno == EINTR)
             continue;
         return ret;
@@ -297,22 +601,37 @@ int read_device(WEATHERSTATION ws, unsigned char *buffer, int size)
 }
 
 /********************************************************************
- * write_device in the Linux version is identical
+ * serial_write_device in the Linux version is identical
  * to the standard Linux write()
  *
- * Inputs:  serdevice - opened file handle
+ * Inputs:  ws - handle to the weatherstation
  *          buffer - pointer to the buffer to write from
  *          size - number of bytes to write
  *
  * Returns: number of bytes written
  *
  ********************************************************************/
-int write_device(WEATHERSTATION serdevice, unsigned char *buffer, int size)
+static int serial_write_device(WEATHERSTATION ws, unsigned char *buffer, int size)
 {
-    int ret = write(serdevice, buffer, size);
+    int ret = write(ws->fd, buffer, size);
     return ret;
 }
 
+const struct transport8610 serial_transport = {
+    NULL,
+    serial_open,
+    serial_close,
+    serial_set_DTR,
+    serial_set_RTS,
+    serial_get_DSR,
+    serial_get_CTS,
+    serial_read_device,
+    serial_write_device,
+    NULL,
+    NULL,
+    serial_wait_DSR
+};
+
 /********************************************************************
  * sleep_short - Linux version
  *
@@ -326,10 +645,70 @@ void sleep_short(int milliseconds)
     usleep(milliseconds * 1000);
 }
 
+/********************************************************************
+ * spin
+ * Busy loop of a given number of iterations, the unit calibrate()
+ * measures
+ *
+ ********************************************************************/
+static void spin(long spins)
+{
+    volatile long i;
+
+    for (i = 0; i < spins; i++)
+        ;
+}
+
+static long long timespec_diff_ns(struct timespec *a, struct timespec *b)
+{
+    return (a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+/********************************************************************
+ * calibrate
+ * Measures the speed of the spin loop against CLOCK_MONOTONIC and
+ * stores it in spins_per_ns. The fastest of a few runs is used so a
+ * preemption during calibration does not skew the result.
+ *
+ * Inputs:  none
+ *
+ * Returns: spins per microsecond
+ *
+ ********************************************************************/
+long calibrate()
+{
+    struct timespec start, end;
+    long long elapsed, best = 0;
+    int i;
+
+    for (i = 0; i < CALIBRATE_RUNS; i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        spin(CALIBRATE_SPINS);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed = timespec_diff_ns(&end, &start);
+        if (elapsed > 0 && (best == 0 || elapsed < best))
+            best = elapsed;
+    }
+    if (best == 0)
+        best = 1;
+
+    spins_per_ns = (float)CALIBRATE_SPINS / best;
+    LOG(2, "calibrate: %.3f spins per ns", spins_per_ns);
+
+    return (long)(spins_per_ns * 1000);
+}
+
 /********************************************************************
  * nanodelay
  * delays given time in ns
  *
+ * Delays are paced against a deadline: the wait is counted from the
+ * end of the previous delay, so the time spent in the ioctls between
+ * two delays is not paid twice and the waits of a byte do not drift.
+ * Short waits spin a calibrated loop, medium waits poll the monotonic
+ * clock and long waits sleep until shortly before the deadline.
+ *
  * Inputs:  ns - time to delay in ns
  *
  *
@@ -339,9 +718,54 @@ void sleep_short(int milliseconds)
 
 void nanodelay(long ns)
 {
-    struct timespec sleepTime;
-    struct timespec returnTime;
-    sleepTime.tv_sec = 0;
-    sleepTime.tv_nsec = ns;
-    nanosleep(&sleepTime, &returnTime);
+    static struct timespec pace;    // deadline of the previous delay
+    struct timespec now, deadline;
+    long long remaining;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline.tv_sec = pace.tv_sec + ns / 1000000000L;
+    deadline.tv_nsec = pace.tv_nsec + ns % 1000000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    remaining = timespec_diff_ns(&deadline, &now);
+    if (remaining <= 0)
+    {
+        // Enough time has passed already, start pacing from now
+        pace = now;
+        return;
+    }
+    pace = deadline;
+
+    if (remaining > SLEEP_LIMIT_NS)
+    {
+        struct timespec wake = deadline;
+
+        wake.tv_nsec -= SLEEP_SLACK_NS;
+        if (wake.tv_nsec < 0)
+        {
+            wake.tv_sec--;
+            wake.tv_nsec += 1000000000L;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR)
+            ;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining = timespec_diff_ns(&deadline, &now);
+    }
+
+    if (remaining <= 0)
+        return;
+
+    if (remaining < SPIN_LIMIT_NS && spins_per_ns > 0)
+    {
+        spin((long)(remaining * spins_per_ns));
+        return;
+    }
+
+    do
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    while (timespec_diff_ns(&deadline, &now) > 0);
 }
@@ -14,14 +14,25 @@
 #include <errno.h>
 #include <sys/file.h>
 
+#include "recorder8610.h"
+
 #define BUFFER_SIZE 16384
-#define DELAY_CONST 1
-#define INIT_WAIT 500
+#define DELAY_CONST 50000      // default BIT_DELAY in ns, what nanosleep(1) gave
+                               // with the default 50 us timer slack
+#define SPIN_LIMIT_NS 2000     // shorter waits spin a calibrated loop
+#define SLEEP_LIMIT_NS 200000  // longer waits sleep until SLEEP_SLACK_NS is left
+#define SLEEP_SLACK_NS 80000
+#define CALIBRATE_SPINS 1000000
+#define CALIBRATE_RUNS 3
+#define INIT_WAIT 500          // handshake timeout in INIT_POLL_MS steps
+#define INIT_POLL_MS 10        // DSR poll interval if the port cannot wait
+#define DSR_RECHECK_MS 50      // DSR is read again this often while waiting
+                               // on TIOCMIWAIT, in case an edge slipped by
 
 #define BAUDRATE B300
 #define DEFAULT_SERIAL_DEVICE "/dev/ttyS0"
 
-typedef int WEATHERSTATION;
+typedef struct weatherstation *WEATHERSTATION;
 
 #endif /* _INCLUDE_LINUX8610_H_ */
 
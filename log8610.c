@@ -56,9 +56,9 @@ int main(int argc, char *argv[])
 {
     WEATHERSTATION ws;
     FILE *fileptr;
-    unsigned char logline[1024] = "";
-    char str[50];
+    static struct sink out;
     char datestring[100];        //used to hold the date stamp for the log file
+    char stampstring[100];
     time_t basictime;
     struct history_record hr;
     int o_count;
@@ -89,46 +89,39 @@ int main(int argc, char *argv[])
         exit(-1);
     }
 
-    read_last_history_record(ws, &hr, o_count);
+    if (read_last_history_record(ws, &hr, o_count) == -1)
+    {
+        printf("No history records in the station\n");
+        fclose(fileptr);
+        close_weatherstation(ws);
+        exit(-1);
+    }
 
     close_weatherstation(ws);
 
 
-    /* READ TEMPERATURE INDOOR */
-    sprintf(logline,"%sTi: %s | ", logline, temp2str(hr.Temp[0], "%.1f", str));
-
-    /* READ RELATIVE HUMIDITY INDOOR */
-    sprintf(logline,"%sHi: %s | ", logline, RH2str(hr.RH[0], "%d", str));
-
-    /* READ TEMPERATURE OUTDOOR */
-    sprintf(logline,"%sTo1: %s | ", logline, temp2str(hr.Temp[1], "%.1f", str));
-
-    /* READ RELATIVE HUMIDITY OUTDOOR */
-    sprintf(logline,"%sHo1: %s | ", logline, RH2str(hr.RH[1], "%d", str));
-
-    /* READ SECOND TEMPERATURE OUTDOOR */
-    sprintf(logline,"%sTo2: %s | ", logline, temp2str(hr.Temp[2], "%.1f", str));
-
-    /* READ SECOND RELATIVE HUMIDITY OUTDOOR */
-    sprintf(logline,"%sHo2: %s | ", logline, RH2str(hr.RH[2], "%d", str));
-
-    /* READ THIRD TEMPERATURE OUTDOOR */
-    sprintf(logline,"%sTo3: %s | ", logline, temp2str(hr.Temp[3], "%.1f", str));
-
-    /* READ THIRD RELATIVE HUMIDITY OUTDOOR */
-    sprintf(logline,"%sHo3: %s | ", logline, RH2str(hr.RH[3], "%d", str));
-
-    /* GET TIME STAMP OF LAST HISTORY RECORD */
-    sprintf(logline,"%s%s", logline, ctime(&hr.time_stamp));
-
     /* GET DATE AND TIME FOR LOG FILE, PLACE BEFORE ALL DATA IN LOG LINE */
     time(&basictime);
-    strftime(datestring,sizeof(datestring),"%d/%m %H:%M:%S |",
+    strftime(datestring,sizeof(datestring),"%d/%m %H:%M:%S",
              localtime(&basictime));
 
-    // Print out and leave
-    printf("%s %s",datestring, logline);
-    fprintf(fileptr,"%s %s",datestring, logline);
+    /* TIME STAMP OF LAST HISTORY RECORD, WITHOUT THE NEWLINE */
+    strftime(stampstring, sizeof(stampstring), "%a %b %e %H:%M:%S %Y",
+             localtime(&hr.time_stamp));
+
+    // One record to stdout and the log file, with a CSV header only
+    // at the start of a new file
+    fseek(fileptr, 0, SEEK_END);
+    sink_open(&out, config.output_format, ftell(fileptr) == 0);
+    sink_add_fd(&out, STDOUT_FILENO);
+    sink_add_fd(&out, fileno(fileptr));
+
+    sink_begin(&out, "ws8610", hr.time_stamp);
+    sink_string(&out, NULL, datestring);
+    sink_history_fields(&out, &hr, 4);
+    sink_string(&out, NULL, stampstring);
+    sink_end(&out);
+    sink_close(&out);
 
     fclose(fileptr);
 
@@ -48,10 +48,9 @@ void print_usage(void)
 int main(int argc, char *argv[])
 {
     WEATHERSTATION ws;
-    struct config_type config;
     unsigned char data[2];
-    int enable;
-    unsigned char records[128];
+    int enable, records = 0;
+    struct station_header header;
 
     if (argc < 2 || argc > 3)
     {
@@ -65,16 +64,30 @@ int main(int argc, char *argv[])
 
     if (enable == 1)
     {
+        if (read_history_info(ws, &header) == -1)
+            read_error_exit();
+        records = header.record_count;
+
+        // 80 02 is a command, the station answers it by resetting the
+        // history count, so it is sent as is and never read back
         printf("Wiping data history from the ws8610\n");
         data[0] = 0x80;
         data[1] = 0x02;
         write_data(ws, 0x0009, 2, data);
     }
 
-    read_safe(ws, 0x0009, 2, records);
+    if (read_history_info(ws, &header) == -1)
+        read_error_exit();
+
+    if (enable == 1 && records > 0 && header.record_count >= records)
+    {
+        printf("The station did not reset its history count\n");
+        close_weatherstation(ws);
+        exit(EXIT_FAILURE);
+    }
 
     printf("Data wiped if enable was used. Enable= %d\n", enable);
-    printf("Number of valid records now is %d\n", history_length(records));
+    printf("Number of valid records now is %d\n", header.record_count);
 
     close_weatherstation(ws);
 
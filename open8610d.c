@@ -0,0 +1,239 @@
+/*  open8610 - open8610d.c
+ *
+ *  Version 0.01
+ *
+ *  Control WS8610 weather station
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "rw8610.h"
+#include "daemon8610.h"
+#include <poll.h>
+#include <signal.h>
+
+static volatile sig_atomic_t stop_requested;
+
+/********************************************************************
+ * print_usage prints a short user guide
+ *
+ * Input:   none
+ *
+ * Output:  prints to stdout
+ *
+ * Returns: exits program
+ *
+ ********************************************************************/
+void print_usage(void)
+{
+    printf("\n");
+    printf("open8610d - Keep a WS-8610 open and serve it to other programs\n");
+    printf("This program is released under the GNU General Public License (GPL)\n\n");
+    printf("Usage:\n");
+    printf("open8610d socketfile config_filename\n");
+    printf("The station is opened once on the SERIAL_DEVICE of the config file.\n");
+    printf("Other programs use it by setting SERIAL_DEVICE unix:socketfile\n");
+    printf("Link statistics go to METRICS_FILE every minute and are served\n");
+    printf("over HTTP on METRICS_PORT if set.\n");
+    exit(0);
+}
+
+static void handle_stop(int sig)
+{
+    stop_requested = 1;
+}
+
+/* Counters of a lost station, carried over to the reopened one so the
+ * metrics keep counting up */
+static struct link_stats lost_stats;
+
+/********************************************************************
+ * lose_weatherstation
+ * Closes a station that stopped answering, keeping its counters
+ *
+ * Input:   ws - handle to the weatherstation
+ *
+ ********************************************************************/
+static void lose_weatherstation(WEATHERSTATION ws)
+{
+    stats_add(&lost_stats, &ws->stats);
+    close_weatherstation(ws);
+}
+
+/********************************************************************
+ * reopen_weatherstation
+ * Tries to open a lost station again, carrying the counters over
+ *
+ * Returns: handle to the reopened weatherstation, NULL if it still
+ *          does not answer
+ *
+ ********************************************************************/
+static WEATHERSTATION reopen_weatherstation(void)
+{
+    WEATHERSTATION ws;
+
+    if ((ws = try_open_weatherstation(config.serial_device_name)) == NULL)
+        return NULL;
+    stats_add(&ws->stats, &lost_stats);
+    memset(&lost_stats, 0, sizeof(lost_stats));
+    return ws;
+}
+
+
+/********** MAIN PROGRAM ************************************************
+ *
+ * This program opens and initializes the station once and then
+ * serves read_safe() and write_data() requests of the other programs
+ * over a Unix domain socket, so they skip the connect handshake.
+ * When no client has asked for anything for DAEMON_KEEPALIVE seconds
+ * the link is touched with a one byte read, and reopened if the
+ * station stopped answering. Until it answers again requests fail and
+ * a reopen is tried every DAEMON_REOPEN_EVERY seconds. A client gets
+ * DAEMON_CLIENT_TIMEOUT to finish a request it started, so a stalled
+ * one cannot hold up the others. The link statistics are written to
+ * METRICS_FILE every DAEMON_METRICS_EVERY seconds and served to
+ * Prometheus on METRICS_PORT.
+ *
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+    WEATHERSTATION ws;
+    struct pollfd fds[DAEMON_MAX_CLIENTS + 2];
+    struct sigaction sa;
+    unsigned char data[1];
+    time_t metrics_time = time(NULL), reopen_time = 0;
+    int nfds = 1, first_client = 1;
+    int i, ret, fd;
+
+    if (argc < 2 || argc > 3)
+    {
+        print_usage();
+    }
+
+    get_configuration(&config, argv[2]);
+
+    if (strncmp(config.serial_device_name, "unix:", 5) == 0)
+    {
+        printf("open8610d cannot serve its own socket, set SERIAL_DEVICE to the station\n");
+        exit(EXIT_FAILURE);
+    }
+
+    ws = open_weatherstation(config.serial_device_name);
+
+    if ((fds[0].fd = daemon_listen(argv[1])) < 0)
+    {
+        perror("open8610d - cannot listen on socket");
+        close_weatherstation(ws);
+        exit(EXIT_FAILURE);
+    }
+    fds[0].events = POLLIN;
+
+    if (config.metrics_port > 0)
+    {
+        if ((fds[1].fd = daemon_metrics_listen(config.metrics_port)) < 0)
+        {
+            perror("open8610d - cannot listen on metrics port");
+            close(fds[0].fd);
+            close_weatherstation(ws);
+            exit(EXIT_FAILURE);
+        }
+        fds[1].events = POLLIN;
+        nfds = first_client = 2;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    LOG(1, "open8610d - serving");
+
+    while (!stop_requested)
+    {
+        ret = poll(fds, nfds, (ws != NULL ? DAEMON_KEEPALIVE : DAEMON_REOPEN_EVERY) * 1000);
+        if (ret < 0)
+            continue;
+
+        if (ws == NULL && time(NULL) - reopen_time >= DAEMON_REOPEN_EVERY)
+        {
+            if ((ws = reopen_weatherstation()) != NULL)
+                LOG(1, "open8610d - station reopened");
+            reopen_time = time(NULL);
+        }
+
+        if (ws != NULL && config.metrics_file[0] != '\0' &&
+            time(NULL) - metrics_time >= DAEMON_METRICS_EVERY)
+        {
+            if (stats_write_textfile(ws, config.metrics_file,
+                                     config.serial_device_name) < 0)
+                LOG(1, "open8610d - cannot write %s", config.metrics_file);
+            metrics_time = time(NULL);
+        }
+
+        if (ret == 0)
+        {
+            // Idle, make sure the station still answers
+            if (ws != NULL && read_safe(ws, 0, 1, data) == -1)
+            {
+                LOG(1, "open8610d - station lost, reopening");
+                lose_weatherstation(ws);
+                if ((ws = reopen_weatherstation()) == NULL)
+                    LOG(1, "open8610d - station does not answer, retrying");
+                reopen_time = time(NULL);
+            }
+            continue;
+        }
+
+        for (i = nfds - 1; i >= first_client; i--)
+        {
+            if (fds[i].revents == 0)
+                continue;
+            if (daemon_serve(ws, fds[i].fd) < 0)
+            {
+                close(fds[i].fd);
+                fds[i] = fds[--nfds];
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            if ((fd = daemon_accept(fds[0].fd)) < 0)
+                continue;
+            if (nfds == first_client + DAEMON_MAX_CLIENTS)
+            {
+                LOG(1, "open8610d - too many clients");
+                close(fd);
+                continue;
+            }
+            fds[nfds].fd = fd;
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            nfds++;
+        }
+
+        if (first_client == 2 && (fds[1].revents & POLLIN))
+        {
+            if ((fd = accept(fds[1].fd, NULL, NULL)) < 0)
+                continue;
+            if (ws == NULL)
+                close(fd);
+            else if (daemon_metrics_serve(ws, fd) < 0)
+                LOG(2, "open8610d - metrics request failed");
+        }
+    }
+
+    for (i = 0; i < nfds; i++)
+        close(fds[i].fd);
+    unlink(argv[1]);
+    if (ws != NULL)
+    {
+        if (config.metrics_file[0] != '\0' &&
+            stats_write_textfile(ws, config.metrics_file,
+                                 config.serial_device_name) < 0)
+            LOG(1, "open8610d - cannot write %s", config.metrics_file);
+        close_weatherstation(ws);
+    }
+
+    return(0);
+}
@@ -0,0 +1,239 @@
+/*  open8610  - recorder8610 protocol flight recorder
+ *  This file keeps the ring of recent protocol events and writes it
+ *  out, see recorder8610.h. Dumping only uses async signal safe calls
+ *  so it can run from the SIGUSR1 handler.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "recorder8610.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CALIBRATE_MIN_NS    10000000LL  // clock rate is measured over 10 ms at least
+
+struct recorder_event recorder_ring[RECORDER_EVENTS];
+uint32_t recorder_head;
+
+static char dump_file[256] = RECORDER_DEFAULT_FILE;
+static char dump_tmp[sizeof(dump_file) + 4] = RECORDER_DEFAULT_FILE ".tmp";
+static uint64_t start_clock;            // raw clock and monotonic ns when
+static long long start_ns;              // recording started
+static unsigned char dump_buffer[RECORDER_HEADER_SIZE +
+                                 RECORDER_EVENTS * RECORDER_EVENT_SIZE];
+
+
+static long long monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Little endian stores into a byte buffer */
+static void put16(unsigned char *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static void put64(unsigned char *p, uint64_t v)
+{
+    put32(p, v);
+    put32(p + 4, v >> 32);
+}
+
+static void dump_signal(int signum)
+{
+    int saved_errno = errno;
+
+    (void)signum;
+    recorder_dump(RECORDER_SIGNAL);
+    errno = saved_errno;
+}
+
+
+/********************************************************************
+ * recorder_init
+ * Sets where the ring is dumped and installs the SIGUSR1 handler.
+ * Events are recorded whether or not this has been called.
+ *
+ * Input:   filename - dump file, NULL or "" for RECORDER_DEFAULT_FILE
+ *
+ ********************************************************************/
+void recorder_init(const char *filename)
+{
+    struct sigaction sa;
+
+    if (filename != NULL && filename[0] != '\0')
+    {
+        strncpy(dump_file, filename, sizeof(dump_file) - 1);
+        dump_file[sizeof(dump_file) - 1] = '\0';
+        // Built here, snprintf() is not safe in the signal handler
+        snprintf(dump_tmp, sizeof(dump_tmp), "%s.tmp", dump_file);
+    }
+
+    if (start_ns == 0)
+    {
+        start_clock = recorder_clock();
+        start_ns = monotonic_ns();
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dump_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    recorder_event(EVENT_OPEN, 0, 0);
+}
+
+const char *recorder_file(void)
+{
+    return dump_file;
+}
+
+/* Writes the dump, see recorder_dump() */
+static int write_dump(int reason)
+{
+    uint32_t head = __atomic_load_n(&recorder_head, __ATOMIC_ACQUIRE);
+    uint32_t first, i;
+    unsigned char *p = dump_buffer + RECORDER_HEADER_SIZE;
+    uint64_t now_clock;
+    long long now_ns;
+    double scale = 1.0;
+    size_t length, done;
+    ssize_t n;
+    int fd;
+
+    // The slot after the newest event is the one the writer may be
+    // filling if the dump interrupted it
+    first = head > RECORDER_EVENTS - 1 ? head - (RECORDER_EVENTS - 1) : 0;
+
+    now_clock = recorder_clock();
+    now_ns = monotonic_ns();
+#if defined(__x86_64__) || defined(__i386__)
+    if (start_ns == 0)
+    {
+        start_clock = now_clock;
+        start_ns = now_ns;
+    }
+    while (now_ns - start_ns < CALIBRATE_MIN_NS)
+    {
+        struct timespec pause = { 0, CALIBRATE_MIN_NS - (now_ns - start_ns) };
+
+        nanosleep(&pause, NULL);
+        now_clock = recorder_clock();
+        now_ns = monotonic_ns();
+    }
+    scale = (double)(now_ns - start_ns) / (double)(now_clock - start_clock);
+#endif
+
+    for (i = first; i != head; i++)
+    {
+        struct recorder_event *e = &recorder_ring[i & (RECORDER_EVENTS - 1)];
+
+        // Counted back from now, so recent events are the most exact
+        put64(p, now_ns - (long long)((double)(int64_t)(now_clock - e->time) * scale));
+        put16(p + 8, e->type);
+        put16(p + 10, e->value);
+        put32(p + 12, e->arg);
+        p += RECORDER_EVENT_SIZE;
+    }
+
+    memcpy(dump_buffer, RECORDER_MAGIC, 8);
+    put32(dump_buffer + 8, RECORDER_VERSION);
+    put32(dump_buffer + 12, head - first);
+    put64(dump_buffer + 16, (uint64_t)time(NULL));
+    put32(dump_buffer + 24, reason);
+    put32(dump_buffer + 28, 0);
+
+    // A fresh file renamed over the dump file, so a symlink planted at
+    // either name is replaced rather than followed
+    unlink(dump_tmp);
+    if ((fd = open(dump_tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0644)) < 0)
+        return -1;
+    length = p - dump_buffer;
+    for (done = 0; done < length; done += n)
+    {
+        n = write(fd, dump_buffer + done, length - done);
+        if (n < 0 && errno == EINTR)
+            n = 0;
+        else if (n <= 0)
+        {
+            close(fd);
+            unlink(dump_tmp);
+            return -1;
+        }
+    }
+    if (close(fd) < 0 || rename(dump_tmp, dump_file) < 0)
+    {
+        unlink(dump_tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/********************************************************************
+ * recorder_dump
+ * Writes the events in the ring to the dump file, oldest first, with
+ * their times converted to monotonic ns. SIGUSR1 is held off while it
+ * runs, a second dump would overwrite the one buffer half way.
+ *
+ * Input:   reason - RECORDER_SIGNAL or RECORDER_READ_FAILED
+ *
+ * Returns: 0 on success, -1 if the file could not be written
+ *
+ ********************************************************************/
+int recorder_dump(int reason)
+{
+    sigset_t block, saved;
+    int ret;
+
+    sigemptyset(&block);
+    sigaddset(&block, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &block, &saved);
+    ret = write_dump(reason);
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+    return ret;
+}
+
+/********************************************************************
+ * recorder_event_name
+ *
+ * Input:   type - EVENT_ type
+ *
+ * Returns: name of the event for printing
+ *
+ ********************************************************************/
+const char *recorder_event_name(int type)
+{
+    static const char *names[] = {
+        [EVENT_SET_DTR] = "set DTR",
+        [EVENT_SET_RTS] = "set RTS",
+        [EVENT_GET_CTS] = "get CTS",
+        [EVENT_GET_DSR] = "get DSR",
+        [EVENT_WRITE_BYTE] = "write byte",
+        [EVENT_READ_BYTE] = "read byte",
+        [EVENT_READ_BLOCK] = "read block",
+        [EVENT_MISMATCH] = "mismatch",
+        [EVENT_READ_FAILED] = "read failed",
+        [EVENT_OPEN] = "open",
+    };
+
+    if (type <= 0 || type >= (int)(sizeof(names) / sizeof(names[0])))
+        return "unknown";
+    return names[type];
+}
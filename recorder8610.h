@@ -0,0 +1,95 @@
+/* Include file for the open8610 flight recorder
+ *
+ * The flight recorder keeps the last RECORDER_EVENTS protocol events
+ * (modem line writes and reads, bytes sent and received, block reads
+ * and their retries) in a ring in memory, always on. The ring is
+ * written to a file when a read fails for good or the process gets
+ * SIGUSR1, and flight8610 prints it.
+ *
+ * Dump file layout, all numbers little endian:
+ *
+ *   header   "WS8610FR", uint32 version, uint32 event count,
+ *            int64 wall clock time of the dump (seconds since 1970),
+ *            uint32 reason, uint32 reserved
+ *   events   oldest first: uint64 monotonic time in ns, uint16 type,
+ *            uint16 value, uint32 argument
+ */
+
+#ifndef _INCLUDE_RECORDER8610_H_
+#define _INCLUDE_RECORDER8610_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define RECORDER_EVENTS         4096    // power of two
+#define RECORDER_MAGIC          "WS8610FR"
+#define RECORDER_VERSION        1
+#define RECORDER_HEADER_SIZE    32
+#define RECORDER_EVENT_SIZE     16
+#define RECORDER_DEFAULT_FILE   "/tmp/open8610.flight"
+
+// Event types: value / argument
+#define EVENT_SET_DTR           1       // level
+#define EVENT_SET_RTS           2       // level
+#define EVENT_GET_CTS           3       // level
+#define EVENT_GET_DSR           4       // level
+#define EVENT_WRITE_BYTE        5       // byte, acknowledge seen
+#define EVENT_READ_BYTE         6       // byte
+#define EVENT_READ_BLOCK        7       // bytes / address
+#define EVENT_MISMATCH          8       // bytes / address of the block
+#define EVENT_READ_FAILED       9       // bytes / address
+#define EVENT_OPEN              10      // - / -
+
+// Why the ring was dumped
+#define RECORDER_SIGNAL         1
+#define RECORDER_READ_FAILED    2
+
+struct recorder_event
+{
+    uint64_t time;          // raw clock, ns once dumped
+    uint16_t type;
+    uint16_t value;
+    uint32_t arg;
+};
+
+extern struct recorder_event recorder_ring[RECORDER_EVENTS];
+extern uint32_t recorder_head;
+
+/* Raw timestamp: the time stamp counter where there is one, converted
+ * to ns when the ring is dumped, the monotonic clock otherwise */
+static inline uint64_t recorder_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* Adds an event. There is one writer; the head is published after the
+ * slot is filled so a dump from a signal handler never sees a half
+ * written event. */
+static inline void recorder_event(int type, int value, uint32_t arg)
+{
+    uint32_t head = recorder_head;
+    struct recorder_event *e = &recorder_ring[head & (RECORDER_EVENTS - 1)];
+
+    e->time = recorder_clock();
+    e->type = type;
+    e->value = value;
+    e->arg = arg;
+    __atomic_store_n(&recorder_head, head + 1, __ATOMIC_RELEASE);
+}
+
+void recorder_init(const char *filename);
+
+int recorder_dump(int reason);
+
+const char *recorder_file(void);
+
+const char *recorder_event_name(int type);
+
+#endif /* _INCLUDE_RECORDER8610_H_ */
@@ -13,6 +13,7 @@
  */
 
 #include "rw8610.h"
+#include "image8610.h"
 
 //calibration value for nanodelay function
 float spins_per_ns;
@@ -20,12 +21,69 @@ float spins_per_ns;
 //configuration data, global variable for easy availability in many function
 struct config_type config;
 
-//some constants defined as array for easy use
-static int history_record_length[] = {10,13,15};
-static int max_history_record[] = {
-    HISTORY_BUFFER_SIZE / 10,
-    HISTORY_BUFFER_SIZE / 13,
-    HISTORY_BUFFER_SIZE / 15
+//station clock converter for timestamps read out of order
+static struct station_clock default_clock = { CLOCK_NO_DAY };
+
+static void cursor_stop(struct read_cursor *cursor);
+
+
+/* BCD digits of a record field, see RECORD_T0_NIBBLE */
+#define NIBBLE(data, n)     (((data)[(n) >> 1] >> (((n) & 1) * 4)) & 0xF)
+#define RECORD_TEMP(data, n) \
+    (NIBBLE(data, (n) + 2) * 10 + NIBBLE(data, (n) + 1) + NIBBLE(data, n) / 10.0 - 30.0)
+#define RECORD_TENTHS(data, n) \
+    (NIBBLE(data, (n) + 2) * 100 + NIBBLE(data, (n) + 1) * 10 + NIBBLE(data, n) - 300)
+#define RECORD_RH(data, n)  (NIBBLE(data, (n) + 1) * 10 + NIBBLE(data, n))
+
+/* Channels stored by each record format as X(channel, temp, rh) */
+#define CHANNELS_10(X) \
+    X(0, RECORD_T0_NIBBLE, RECORD_RH0_NIBBLE) \
+    X(1, RECORD_T1_NIBBLE, RECORD_RH1_NIBBLE)
+#define CHANNELS_13(X) CHANNELS_10(X) \
+    X(2, RECORD_T2_NIBBLE, RECORD_RH2_NIBBLE)
+#define CHANNELS_15(X) CHANNELS_13(X) \
+    X(3, RECORD_T3_NIBBLE, RECORD_RH3_NIBBLE)
+
+#define DECODE_CHANNEL(ch, t_nib, rh_nib) \
+    if ((value = RECORD_TENTHS(record, t_nib)) != RECORD_TENTHS_INVALID) \
+    { \
+        pr->temp[ch] = value; \
+        pr->valid |= PACKED_TEMP_VALID(ch); \
+    } \
+    if ((value = RECORD_RH(record, rh_nib)) != RECORD_RH_INVALID) \
+    { \
+        pr->rh[ch] = value; \
+        pr->valid |= PACKED_RH_VALID(ch); \
+    }
+#define COUNT_CHANNEL(ch, t_nib, rh_nib)    + 1
+#define TEMP_NIBBLE(ch, t_nib, rh_nib)      [ch] = t_nib,
+#define RH_NIBBLE(ch, t_nib, rh_nib)        [ch] = rh_nib,
+
+/* One decoder per format with all offsets constant, channels the
+ * format does not store stay invalid */
+#define DEFINE_RECORD_DECODER(name, channels) \
+static void name(unsigned char *record, struct station_clock *sc, \
+                 struct packed_record *pr) \
+{ \
+    int value; \
+    memset(pr, 0, sizeof(*pr)); \
+    pr->time = hist_timestamp_clock(sc, record); \
+    channels(DECODE_CHANNEL) \
+}
+
+DEFINE_RECORD_DECODER(decode_record10, CHANNELS_10)
+DEFINE_RECORD_DECODER(decode_record13, CHANNELS_13)
+DEFINE_RECORD_DECODER(decode_record15, CHANNELS_15)
+
+#define RECORD_LAYOUT(length, channels, decoder) \
+    { length, HISTORY_BUFFER_SIZE / length, 0 channels(COUNT_CHANNEL), \
+      { channels(TEMP_NIBBLE) }, { channels(RH_NIBBLE) }, decoder }
+
+//record formats indexed by the count of additional outdoor sensors
+static const struct record_layout record_layouts[] = {
+    RECORD_LAYOUT(10, CHANNELS_10, decode_record10),
+    RECORD_LAYOUT(13, CHANNELS_13, decode_record13),
+    RECORD_LAYOUT(15, CHANNELS_15, decode_record15)
 };
 
 
@@ -87,9 +145,128 @@ char *RH2str(int RH, char *frmt, char *str)
 }
 
 
+/* BCD byte to binary */
+static int bcd_value(unsigned char byte)
+{
+    return (byte >> 4) * 10 + (byte & 0xF);
+}
+
+/* Station clock at 0x00-0x05 in seconds since 1/1/70 */
+static time_t decode_station_time(unsigned char *data)
+{
+    return station_clock_time(&default_clock,
+                              (data[4] >> 4) + (data[5] & 0xF) * 10 + 2000,
+                              (data[3] >> 4) + (data[4] & 0xF) * 10,
+                              (data[2] >> 4) + (data[3] & 0xF) * 10,
+                              bcd_value(data[1]),
+                              bcd_value(data[0]));
+}
+
+/********************************************************************/
+/* decode_header
+ * Decodes the fields of a station header snapshot
+ *
+ * Input: data - header bytes 0x00-0x63
+ *
+ * Output: header - decoded fields and a copy of data
+ ********************************************************************/
+static void decode_header(unsigned char *data, struct station_header *header)
+{
+    uint64_t bits = 0;
+    uint32_t records;
+    double days;
+    int i;
+
+    memcpy(header->data, data, HEADER_SIZE);
+
+    header->time = decode_station_time(data);
+    header->channels = data[0x08];
+    header->record_count = history_length(data + HISTORY_COUNT_ADR);
+    header->loop_flags = data[0x0B];
+    header->outdoor_count = (data[0x0C] & 0xF) - 1;
+    header->record_flags = data[0x0C] >> 4;
+
+    // The PC software stores its last download as a little endian
+    // double counting days from 30/12/1899 in local time
+    for (i = 7; i >= 0; i--)
+        bits = bits << 8 | data[0x51 + i];
+    memcpy(&days, &bits, sizeof(days));
+    header->download_time = 0;
+    if (days > 1.0 && days < 200000.0)
+    {
+        time_t t = (time_t)((days - 25569.0) * 86400.0 + 0.5);
+        struct tm tm;
+
+        gmtime_r(&t, &tm);
+        header->download_time = station_clock_time(&default_clock,
+                                                   tm.tm_year + 1900, tm.tm_mon + 1,
+                                                   tm.tm_mday, tm.tm_hour, tm.tm_min);
+    }
+    records = data[0x59] | data[0x5A] << 8 | data[0x5B] << 16 | (uint32_t)data[0x5C] << 24;
+    header->download_records = records == 0xFFFFFFFF ? 0 : (long)records + 1;
+    header->download_sensors = data[0x5D] & 0xF;
+}
+
+
+/********************************************************************/
+/* read_history_info
+ * Reads the station header, 0x00-0x63, in one transfer and keeps the
+ * snapshot in the handle for the header accessors
+ *
+ * Input: Handle to weatherstation
+ *
+ * Output: header - the decoded snapshot, may be NULL
+ *
+ * Returns: 0 or -1 if read error
+ ********************************************************************/
+int read_history_info(WEATHERSTATION ws, struct station_header *header)
+{
+    unsigned char data[HEADER_SIZE];
+    struct timespec now;
+
+    ws->header_valid = 0;
+    if (read_safe(ws, 0, HEADER_SIZE, data) != HEADER_SIZE)
+        return -1;
+
+    decode_header(data, &ws->header);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ws->header_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    ws->header_valid = 1;
+
+    if (header != NULL)
+        *header = ws->header;
+    return 0;
+}
+
+
+/********************************************************************/
+/* station_header
+ * The station header snapshot, read again if older than HEADER_MAX_AGE
+ * seconds or invalidated by a write to the header
+ *
+ * Input: Handle to weatherstation
+ *
+ * Returns: the snapshot, NULL if read error
+ ********************************************************************/
+const struct station_header *station_header(WEATHERSTATION ws)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!ws->header_valid ||
+        now.tv_sec * 1000000000LL + now.tv_nsec - ws->header_ns > HEADER_MAX_AGE * 1000000000LL)
+    {
+        if (read_history_info(ws, NULL) == -1)
+            return NULL;
+    }
+    return &ws->header;
+}
+
+
 /********************************************************************/
 /* current_timestamp
- * Read the currently stored timestamp
+ * Read the currently stored timestamp. The clock is read from the
+ * station every time, the header snapshot may be seconds old
  *
  * Input: Handle to weatherstation
  *
@@ -98,24 +275,17 @@ char *RH2str(int RH, char *frmt, char *str)
 time_t current_timestamp(WEATHERSTATION ws)
 {
     unsigned char tempdata[6];
-    struct tm t;
 
     if (read_safe(ws, 0, 6, tempdata) == -1) return -1;
-    t.tm_isdst = -1;
-    t.tm_sec  = 0;
-    t.tm_min  = (tempdata[0] >> 4) * 10 + (tempdata[0] & 0xF);
-    t.tm_hour = (tempdata[1] >> 4) * 10 + (tempdata[1] & 0xF);
-    t.tm_mday = (tempdata[2] >> 4) + (tempdata[3] & 0xF) * 10;
-    t.tm_mon  = (tempdata[3] >> 4) + (tempdata[4] & 0xF) * 10 - 1;
-    t.tm_year = (tempdata[4] >> 4) + (tempdata[5] & 0xF) * 10 + 100;
-
-    return mktime(&t);
+    return decode_station_time(tempdata);
 }
 
 
 /********************************************************************/
 /* outdoor_count
- * Return the count of additional outdoor unit (1 is the minimum)
+ * Return the count of additional outdoor unit (1 is the minimum). An
+ * image carries the count in its own header, as the range captured
+ * need not hold 0x0C
  *
  * Input: Handle to weatherstation
  *
@@ -123,11 +293,19 @@ time_t current_timestamp(WEATHERSTATION ws)
  ********************************************************************/
 int outdoor_count(WEATHERSTATION ws)
 {
-    unsigned char tempdata[1];
+    const struct station_header *header;
+    int count;
 
-    if (read_safe(ws, 0x0C, 1, tempdata) == -1) return -1;
+    if (ws->transport == &image_transport)
+        count = image_header(ws)->outdoor_count;
+    else if ((header = station_header(ws)) != NULL)
+        count = header->outdoor_count;
+    else
+        return -1;
 
-    return (tempdata[0] - 1);
+    if (count < 0 || count > 2)
+        return -1;
+    return count;
 }
 
 
@@ -141,7 +319,167 @@ int outdoor_count(WEATHERSTATION ws)
  ********************************************************************/
 int get_history_record_length(int outdoor_count)
 {
-    return (history_record_length[outdoor_count]);
+    return (record_layouts[outdoor_count].length);
+}
+
+
+/********************************************************************/
+/* get_history_record_max
+ * Return the number of records the history ring buffer holds
+ *
+ * Input: additional outdoor sensors count
+ *
+ * Returns: records in the ring before it wraps to record 0
+ ********************************************************************/
+int get_history_record_max(int outdoor_count)
+{
+    return (record_layouts[outdoor_count].record_max);
+}
+
+
+/********************************************************************/
+/* get_record_layout
+ * Return the record format used with a count of outdoor sensors
+ *
+ * Input: additional outdoor sensors count
+ *
+ * Returns: pointer to the layout descriptor
+ ********************************************************************/
+const struct record_layout *get_record_layout(int outdoor_count)
+{
+    return (&record_layouts[outdoor_count]);
+}
+
+
+/********************************************************************/
+/* unpack_record
+ * Converts a packed record to readings in the configured units
+ *
+ * Input: pr - packed record
+ *
+ * Output: hr - history record, readings without a sensor are set to
+ *              RECORD_TEMP_INVALID and RECORD_RH_INVALID
+ ********************************************************************/
+void unpack_record(struct packed_record *pr, struct history_record *hr)
+{
+    int ch;
+
+    hr->time_stamp = pr->time;
+    for (ch = 0; ch < 4; ch++)
+    {
+        hr->Temp[ch] = pr->valid & PACKED_TEMP_VALID(ch) ?
+                       temperature_conv(pr->temp[ch] / 10.0) : RECORD_TEMP_INVALID;
+        hr->RH[ch] = pr->valid & PACKED_RH_VALID(ch) ? pr->rh[ch] : RECORD_RH_INVALID;
+    }
+}
+
+
+/********************************************************************/
+/* sink_history_fields
+ * Adds the readings of a history record to a sink record, named as in
+ * the log8610 log line
+ *
+ * Input: sink - sink with a record begun
+ *        hr - history record
+ *        channels - channels to add, the indoor one first
+ ********************************************************************/
+void sink_history_fields(struct sink *sink, struct history_record *hr, int channels)
+{
+    static const char *temp_keys[4] = { "Ti", "To1", "To2", "To3" };
+    static const char *rh_keys[4] = { "Hi", "Ho1", "Ho2", "Ho3" };
+    char str[20];
+    int ch;
+
+    for (ch = 0; ch < channels; ch++)
+    {
+        sink_number(sink, temp_keys[ch], temp2str(hr->Temp[ch], "%.1f", str));
+        sink_number(sink, rh_keys[ch], RH2str(hr->RH[ch], "%d", str));
+    }
+}
+
+
+/********************************************************************/
+/* decode_packed_records
+ * Decodes consecutive raw records
+ *
+ * Input: layout - record format
+ *        data - count raw records
+ *        sc - station clock converter, sequential if the records are
+ *             in the order written
+ *
+ * Output: out - count packed records
+ ********************************************************************/
+void decode_packed_records(const struct record_layout *layout, unsigned char *data,
+                           int count, struct station_clock *sc,
+                           struct packed_record *out)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        layout->decode(data + i * layout->length, sc, out + i);
+}
+
+
+/********************************************************************/
+/* write_packed_records, read_packed_records
+ * Write or read packed records in the little endian archive format
+ *
+ * Input: fileptr - archive file
+ *        records - records to write or buffer to read into
+ *        count - number of records
+ *
+ * Returns: number of records written or read
+ ********************************************************************/
+int write_packed_records(FILE *fileptr, struct packed_record *records, int count)
+{
+    unsigned char buffer[PACKED_RECORD_SIZE];
+    int i, ch;
+
+    for (i = 0; i < count; i++)
+    {
+        struct packed_record *pr = &records[i];
+
+        memset(buffer, 0, sizeof(buffer));
+        buffer[0] = pr->time;
+        buffer[1] = pr->time >> 8;
+        buffer[2] = pr->time >> 16;
+        buffer[3] = pr->time >> 24;
+        for (ch = 0; ch < 4; ch++)
+        {
+            buffer[4 + 2 * ch] = (uint16_t)pr->temp[ch];
+            buffer[5 + 2 * ch] = (uint16_t)pr->temp[ch] >> 8;
+            buffer[12 + ch] = pr->rh[ch];
+        }
+        buffer[16] = pr->valid;
+        if (fwrite(buffer, sizeof(buffer), 1, fileptr) != 1)
+            break;
+    }
+
+    return i;
+}
+
+int read_packed_records(FILE *fileptr, struct packed_record *records, int count)
+{
+    unsigned char buffer[PACKED_RECORD_SIZE];
+    int i, ch;
+
+    for (i = 0; i < count; i++)
+    {
+        struct packed_record *pr = &records[i];
+
+        if (fread(buffer, sizeof(buffer), 1, fileptr) != 1)
+            break;
+        memset(pr, 0, sizeof(*pr));
+        pr->time = buffer[0] | buffer[1] << 8 | buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+        for (ch = 0; ch < 4; ch++)
+        {
+            pr->temp[ch] = (int16_t)(buffer[4 + 2 * ch] | buffer[5 + 2 * ch] << 8);
+            pr->rh[ch] = buffer[12 + ch];
+        }
+        pr->valid = buffer[16];
+    }
+
+    return i;
 }
 
 
@@ -179,6 +517,41 @@ int hist_hours(unsigned char *data)
 }
 
 
+/********************************************************************/
+/* hist_timestamp
+ * Read the timestamp of a record
+ *
+ * Input: data - pointer to data buffer
+ *
+ * Returns:  seconds since 1/1/70 (local time of the station clock)
+ ********************************************************************/
+time_t hist_timestamp(unsigned char *data)
+{
+    return hist_timestamp_clock(&default_clock, data);
+}
+
+
+/********************************************************************/
+/* hist_timestamp_clock
+ * Read the timestamp of a record with a given converter, use a
+ * sequential one when going through records in the order written
+ *
+ * Input: sc - station clock converter
+ *        data - pointer to data buffer
+ *
+ * Returns:  seconds since 1/1/70 (local time of the station clock)
+ ********************************************************************/
+time_t hist_timestamp_clock(struct station_clock *sc, unsigned char *data)
+{
+    return station_clock_time(sc,
+                              (data[4] >> 4) * 10 + (data[4] & 0xF) + 2000,
+                              (data[3] >> 4) * 10 + (data[3] & 0xF),
+                              (data[2] >> 4) * 10 + (data[2] & 0xF),
+                              (data[1] >> 4) * 10 + (data[1] & 0xF),
+                              (data[0] >> 4) * 10 + (data[0] & 0xF));
+}
+
+
 /********************************************************************/
 /* history_length
  * Read the bytes which give the no of samples held in memory
@@ -208,11 +581,7 @@ int history_length(unsigned char *data)
  ********************************************************************/
 double temperature_indoor(unsigned char *data)
 {
-    int address=0x05; /* 5 bytes on from the start of the stored byte */
-    unsigned char *tempdata = data + address;
-
-    return temperature_conv(((tempdata[1] & 0xF) * 10 +
-                             (tempdata[0] >> 4) + (tempdata[0] & 0xF) / 10.0) - 30.0);
+    return temperature_conv(RECORD_TEMP(data, RECORD_T0_NIBBLE));
 }
 
 
@@ -287,11 +656,7 @@ void temperature_indoor_minmax(unsigned char *data,
  ********************************************************************/
 double temperature_outdoor(unsigned char *data)
 {
-    int address=0x06; /* 6 bytes on from start byte of each history recrd */
-    unsigned char *tempdata = data + address;
-
-    return temperature_conv(((tempdata[1] & 0xF) +
-                             (tempdata[1] >> 4) * 10 + (tempdata[0] >> 4) / 10.0) - 30.0);
+    return temperature_conv(RECORD_TEMP(data, RECORD_T1_NIBBLE));
 }
 
 
@@ -307,11 +672,7 @@ double temperature_outdoor(unsigned char *data)
  ********************************************************************/
 double temperature_outdoor2(unsigned char *data)
 {
-    int address=0x0A; /* 10 bytes on from start byte of each history recrd */
-    unsigned char *tempdata = data + address;
-
-    return temperature_conv(((tempdata[1] & 0xF) * 10 +
-                             (tempdata[0] >> 4) + (tempdata[0] & 0xF) / 10.0) - 30.0);
+    return temperature_conv(RECORD_TEMP(data, RECORD_T2_NIBBLE));
 }
 
 
@@ -327,11 +688,7 @@ double temperature_outdoor2(unsigned char *data)
  ********************************************************************/
 double temperature_outdoor3(unsigned char *data)
 {
-    int address=0x0C; /* 12 bytes on from start byte of each history recrd */
-    unsigned char *tempdata = data + address;
-
-    return temperature_conv(((tempdata[1] & 0xF) +
-                             (tempdata[1] >> 4) * 10 + (tempdata[0] >> 4) / 10.0) - 30.0);
+    return temperature_conv(RECORD_TEMP(data, RECORD_T3_NIBBLE));
 }
 
 
@@ -481,10 +838,7 @@ void dewpoint_minmax(unsigned char *data,
  ********************************************************************/
 int humidity_indoor(unsigned char *data)
 {
-    int address=0x08;
-    unsigned char *tempdata = data + address;
-
-    return ((tempdata[0] >> 4) * 10 + (tempdata[0] & 0xF));
+    return RECORD_RH(data, RECORD_RH0_NIBBLE);
 }
 
 
@@ -551,10 +905,7 @@ void humidity_indoor_minmax(unsigned char *data,
  ********************************************************************/
 int humidity_outdoor(unsigned char *data)
 {
-    int address=0x09;
-    unsigned char *tempdata = data + address;
-
-    return ((tempdata[0] >> 4) * 10 + (tempdata[0] & 0xF));
+    return RECORD_RH(data, RECORD_RH1_NIBBLE);
 }
 
 
@@ -568,10 +919,7 @@ int humidity_outdoor(unsigned char *data)
  ********************************************************************/
 int humidity_outdoor2(unsigned char *data)
 {
-    int address=0x0B;
-    unsigned char *tempdata = data + address;
-
-    return ((tempdata[0] >> 4) + (tempdata[1] & 0xF) * 10);
+    return RECORD_RH(data, RECORD_RH2_NIBBLE);
 }
 
 
@@ -585,10 +933,7 @@ int humidity_outdoor2(unsigned char *data)
  ********************************************************************/
 int humidity_outdoor3(unsigned char *data)
 {
-    int address=0x0E;
-    unsigned char *tempdata = data + address;
-
-    return ((tempdata[0] >> 4) * 10 + (tempdata[0] & 0xF));
+    return RECORD_RH(data, RECORD_RH3_NIBBLE);
 }
 
 
@@ -646,157 +991,360 @@ void humidity_outdoor_minmax(unsigned char *data,
     return;
 }
 
+/* Empties the history read ahead cache */
+static void flush_record_cache(WEATHERSTATION ws)
+{
+    int i;
+
+    for (i = 0; i < RECORD_CACHE_WINDOWS; i++)
+        ws->record_cache[i].length = 0;
+    ws->record_cache_next = RECORD_CACHE_NO_WALK;
+}
+
 /********************************************************************
- * read_history_record
- * Read the history information like time
- * of last record, pointer to last record.
+ * cached_record
+ * Returns a history record from the read ahead cache, reading it on a
+ * miss. A miss shortly after the end of the previous one is taken for
+ * a walk through the history and reads config.read_ahead records in one
+ * transfer; any other miss reads just the record, so single lookups
+ * like the newest record do not pay for the read ahead.
+ *
+ * Each window keeps the history count at 0x09-0x0B it was read under
+ * and only serves records while that is the newest count seen. Every
+ * miss reads the count afresh, a new one also makes the header snapshot
+ * be read again. Once the ring is full the count stops changing, the
+ * cache then lives as long as the header snapshot, at most
+ * HEADER_MAX_AGE. Writes empty it.
+ *
+ * Input:  ws - handle to weatherstation
+ *         layout - record format
+ *         record_no - ring slot of the record
+ *
+ * Returns: pointer to the record, NULL on read error
+ *
+ ********************************************************************/
+static unsigned char *cached_record(WEATHERSTATION ws, const struct record_layout *layout,
+                                    int record_no)
+{
+    const struct station_header *header = station_header(ws);
+    struct record_window *window = &ws->record_cache[0];
+    int address = HISTORY_BUFFER_ADR + layout->length * record_no;
+    int count = 1, i;
+
+    if (header == NULL)
+        return NULL;
+    if (ws->record_cache_ns != ws->header_ns)
+    {
+        // A snapshot newer than the cache may know a newer count, with
+        // the ring full it is all there is to go by
+        if (header->record_count >= layout->record_max)
+            flush_record_cache(ws);
+        else
+            memcpy(ws->record_cache_key, header->data + HISTORY_COUNT_ADR,
+                   sizeof(ws->record_cache_key));
+        ws->record_cache_ns = ws->header_ns;
+    }
+
+    ws->record_cache_tick++;
+    for (i = 0; i < RECORD_CACHE_WINDOWS; i++)
+    {
+        struct record_window *w = &ws->record_cache[i];
+
+        if (w->length > 0 && address >= w->address &&
+            address + layout->length <= w->address + w->length &&
+            memcmp(w->key, ws->record_cache_key, sizeof(w->key)) == 0)
+        {
+            w->used = ws->record_cache_tick;
+            return w->data + (address - w->address);
+        }
+        if (window->length > 0 && (w->length == 0 || w->used < window->used))
+            window = w;
+    }
+
+    if (address >= ws->record_cache_next &&
+        address < ws->record_cache_next + config.read_ahead * layout->length)
+    {
+        count = config.read_ahead;
+        if (count > READ_AHEAD_MAX)
+            count = READ_AHEAD_MAX;
+        if (count > layout->record_max - record_no)
+            count = layout->record_max - record_no;
+        if (count < 1)
+            count = 1;
+    }
+
+    LOG(2, "read_history_packed - reading %d record(s) from slot %d", count, record_no);
+    window->length = 0;
+    if (read_exact(ws, HISTORY_COUNT_ADR, sizeof(window->key), window->key) != sizeof(window->key))
+        return NULL;
+    if (memcmp(window->key, ws->record_cache_key, sizeof(window->key)) != 0)
+    {
+        LOG(2, "read_history_packed - history count changed, read ahead cache emptied");
+        flush_record_cache(ws);
+        memcpy(ws->record_cache_key, window->key, sizeof(window->key));
+        ws->header_valid = 0;
+    }
+    if (read_safe(ws, address, count * layout->length, window->data) != count * layout->length)
+        return NULL;
+    window->address = address;
+    window->length = count * layout->length;
+    window->used = ws->record_cache_tick;
+    ws->record_cache_next = address + window->length;
+
+    return window->data;
+}
+
+
+/********************************************************************
+ * read_history_packed
+ * Read a history record in its compact form
  *
  * Input:  Handle to weatherstation
  *         record - record index number to be read [0x00-0xAE]
- *         hr - pointer to history_record structure
+ *         pr - pointer to packed_record structure
  *         outdoor_count - count of additional external sensor
  *
  * Output: history record
  *
  ********************************************************************/
-int read_history_record(WEATHERSTATION ws, int record_no, struct history_record *hr, int outdoor_count) {
-    unsigned char record[16];
-    struct tm t;
+int read_history_packed(WEATHERSTATION ws, int record_no, struct packed_record *pr, int outdoor_count) {
+    const struct record_layout *layout = &record_layouts[outdoor_count];
+    unsigned char *record;
 
-    while (record_no >= max_history_record[outdoor_count]) record_no -= max_history_record[outdoor_count];
+    while (record_no >= layout->record_max) record_no -= layout->record_max;
 
-    if (read_safe(ws, HISTORY_BUFFER_ADR + history_record_length[outdoor_count] * record_no,
-                  history_record_length[outdoor_count], record) != history_record_length[outdoor_count])
+    if ((record = cached_record(ws, layout, record_no)) == NULL)
         read_error_exit();
     else {
-        int i;
+        int i, n;
         char str[256];
 
-        sprintf(str, "%d additional sensor(s), record length is %d, max record count is %d", outdoor_count,
-                history_record_length[outdoor_count], max_history_record[outdoor_count]);
-        print_log(2, str);
-        sprintf(str, "Reading record %d at 0x%x: ", record_no,
-                HISTORY_BUFFER_ADR + history_record_length[outdoor_count] * record_no);
-        for (i = 0; i < history_record_length[outdoor_count]; i++)
-            sprintf(str, "%s%02X ", str, record[i]);
-        print_log(2, str);
+        LOG(2, "%d additional sensor(s), record length is %d, max record count is %d",
+            outdoor_count, layout->length, layout->record_max);
+        if (LOG_ENABLED(2))
+        {
+            n = sprintf(str, "Reading record %d at 0x%x: ", record_no,
+                        HISTORY_BUFFER_ADR + layout->length * record_no);
+            for (i = 0; i < layout->length; i++)
+                n += sprintf(str + n, "%02X ", record[i]);
+            print_log(2, str);
+        }
     }
 
-    t.tm_isdst = -1;
-    t.tm_sec  = 0;
-    t.tm_min  = (record[0] >> 4) * 10 + (record[0] & 0xF);
-    t.tm_hour = (record[1] >> 4) * 10 + (record[1] & 0xF);
-    t.tm_mday = (record[2] >> 4) * 10 + (record[2] & 0xF);
-    t.tm_mon  = (record[3] >> 4) * 10 + (record[3] & 0xF) - 1;
-    t.tm_year = (record[4] >> 4) * 10 + (record[4] & 0xF) + 100;
-    hr->time_stamp = mktime(&t);
-
-    hr->Temp[0] = temperature_indoor(record);
-    hr->Temp[1] = temperature_outdoor(record);
-    hr->Temp[2] = temperature_outdoor2(record);
-    hr->Temp[3] = temperature_outdoor3(record);
-
-    hr->RH[0] = humidity_indoor(record);
-    hr->RH[1] = humidity_outdoor(record);
-    hr->RH[2] = humidity_outdoor2(record);
-    hr->RH[3] = humidity_outdoor3(record);
+    layout->decode(record, &default_clock, pr);
 
     return 0;
 }
 
 
 /********************************************************************
- * read_last_history_record
- * Read the last history record
+ * read_history_record
+ * Read a history record with readings converted to the configured
+ * units
  *
  * Input:  Handle to weatherstation
+ *         record - record index number to be read [0x00-0xAE]
  *         hr - pointer to history_record structure
  *         outdoor_count - count of additional external sensor
  *
- * Output: last history record
+ * Output: history record
  *
  ********************************************************************/
-int read_last_history_record(WEATHERSTATION ws, struct history_record *hr, int outdoor_count) {
-    time_t current_t;
-    int last_record_no;
-    unsigned char n_record;
-    char str[256];
-
-    read_history_record(ws, 0, hr, outdoor_count);
-    current_t = current_timestamp(ws);
-    last_record_no = (current_t - hr->time_stamp) / 300;
-
-    sprintf(str, "Diff: %d records", last_record_no);
-    print_log(2, str);
-    sprintf(str, "Date record0: %s", ctime(&(hr->time_stamp)));
-    str[strlen(str) - 1] = 0;
-    print_log(2, str);
-    sprintf(str, "Date current: %s", ctime(&current_t));
-    str[strlen(str) - 1] = 0;
-    print_log(2, str);
-
-    // Try to see if record (n+1) is valid
-    if (read_safe(ws, HISTORY_BUFFER_ADR + history_record_length[outdoor_count] * (last_record_no +1), 1, &n_record) != 1)
-        read_error_exit();
-
-    sprintf(str, "Next record start with 0x%02X", (int) n_record);
+int read_history_record(WEATHERSTATION ws, int record_no, struct history_record *hr, int outdoor_count) {
+    struct packed_record pr;
 
-    // If valid then read one record ahead
-    if (n_record != 0xFF) {
-        sprintf(str, "%s, seems valid, skipping to it", str);
-        last_record_no++;
-    } else sprintf(str, "%s, stick with current record", str);
-    print_log(2, str);
+    read_history_packed(ws, record_no, &pr, outdoor_count);
+    unpack_record(&pr, hr);
 
-    return read_history_record(ws, last_record_no, hr, outdoor_count);
+    return 0;
 }
 
 
-/********************************************************************
- * read_error_exit
- * exit location for all calls to read_safe for error exit.
- * includes error reporting.
- *
- ********************************************************************/
-void read_error_exit(void)
+/* Orders two BCD history timestamps, negative if a is older than b */
+static int stamp_compare(unsigned char *a, unsigned char *b)
 {
-    perror("read_safe() error");
-    exit(0);
-}
+    int i;
 
+    for (i = HISTORY_STAMP_SIZE - 1; i >= 0; i--)
+        if (a[i] != b[i])
+            return a[i] - b[i];
+    return 0;
+}
 
-/********************************************************************
- * write_error_exit
- * exit location for all calls to write_safe for error exit.
- * includes error reporting.
- *
- ********************************************************************/
-void write_error_exit(void)
+/* Reads the timestamp of a ring slot, stamp[0] is 0xFF for an unused slot */
+static void read_stamp(WEATHERSTATION ws, int slot, int outdoor_count,
+                       unsigned char *stamp)
 {
-    perror("write_safe() error");
-    exit(0);
+    if (read_safe(ws, HISTORY_BUFFER_ADR + record_layouts[outdoor_count].length * slot,
+                  HISTORY_STAMP_SIZE, stamp) != HISTORY_STAMP_SIZE)
+        read_error_exit();
 }
 
 
 /********************************************************************
- * get_configuration()
- *
- * read setup parameters from ws8610.conf
- * It searches in this sequence:
- * 1. Path to config file including filename given as parameter
- * 2. ./open8610.conf
- * 3. /usr/local/etc/open8610.conf
- * 4. /etc/open8610.conf
- *
- * See file open8610.conf-dist for the format and option names/values
- *
- * input:    config file name with full path - pointer to string
- *
- * output:   struct config populated with valid settings either
- *           from config file or defaults
+ * locate_history_head
+ * Finds the ring slot of the newest history record.
+ *
+ * Records are written to consecutive slots, wrapping to slot 0 when
+ * the ring is full. Counting from slot 0, every slot up to the newest
+ * record is in use and not older than slot 0; every slot after it is
+ * either unused (0xFF) or older than slot 0 because it was written
+ * before the last wrap. That splits the ring in two, so the newest
+ * record is found by a binary search reading only timestamps. The
+ * head is cached in the handle; later calls check it and follow any
+ * records written since, which normally costs a single probe. A fresh
+ * header snapshot of a ring that has not wrapped yet gives the head
+ * directly.
+ *
+ * Input:  ws - handle to weatherstation
+ *         outdoor_count - count of additional external sensor
  *
- * returns:  0 = OK
- *          -1 = no config file or file open error
+ * Returns: slot of the newest record, -1 if the ring is empty
+ *
+ ********************************************************************/
+int locate_history_head(WEATHERSTATION ws, int outdoor_count)
+{
+    unsigned char stamp0[HISTORY_STAMP_SIZE], stamp[HISTORY_STAMP_SIZE];
+    int record_max = record_layouts[outdoor_count].record_max;
+    int lo, hi, mid, i;
+
+    if (ws->history_head_length == record_layouts[outdoor_count].length)
+    {
+        // Is the cached head still there, and what came after it?
+        read_stamp(ws, ws->history_head, outdoor_count, stamp);
+        for (i = 0; i < HISTORY_FOLLOW_MAX &&
+             stamp_compare(stamp, ws->history_head_stamp) == 0; i++)
+        {
+            int next = (ws->history_head + 1) % record_max;
+
+            read_stamp(ws, next, outdoor_count, stamp);
+            if (stamp[0] == 0xFF || stamp_compare(stamp, ws->history_head_stamp) <= 0)
+                return ws->history_head;
+            ws->history_head = next;
+            memcpy(ws->history_head_stamp, stamp, HISTORY_STAMP_SIZE);
+        }
+        LOG(2, "locate_history_head - cached head is stale, searching");
+    }
+
+    ws->history_head_length = 0;
+
+    // Until the ring first wraps the record count of a header snapshot
+    // is the write position: the slot before it is used, the one at it
+    // not. Two probes confirm that, otherwise search.
+    if (ws->header_valid && ws->header.outdoor_count == outdoor_count &&
+        ws->header.record_count > 0 && ws->header.record_count < record_max)
+    {
+        lo = ws->header.record_count - 1;
+        read_stamp(ws, lo + 1, outdoor_count, stamp0);
+        read_stamp(ws, lo, outdoor_count, stamp);
+        if (stamp0[0] == 0xFF && stamp[0] != 0xFF)
+        {
+            ws->history_head = lo;
+            ws->history_head_length = record_layouts[outdoor_count].length;
+            memcpy(ws->history_head_stamp, stamp, HISTORY_STAMP_SIZE);
+            LOG(2, "locate_history_head - newest record in slot %d by the header", lo);
+            return lo;
+        }
+    }
+
+    read_stamp(ws, 0, outdoor_count, stamp0);
+    if (stamp0[0] == 0xFF)
+        return -1;
+
+    // Slot lo belongs to the newest part of the ring, slot hi does not
+    lo = 0;
+    hi = record_max;
+    while (hi - lo > 1)
+    {
+        mid = lo + (hi - lo) / 2;
+        read_stamp(ws, mid, outdoor_count, stamp);
+        if (stamp[0] != 0xFF && stamp_compare(stamp, stamp0) >= 0)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        memcpy(stamp, stamp0, HISTORY_STAMP_SIZE);
+    else
+        read_stamp(ws, lo, outdoor_count, stamp);
+    ws->history_head = lo;
+    ws->history_head_length = record_layouts[outdoor_count].length;
+    memcpy(ws->history_head_stamp, stamp, HISTORY_STAMP_SIZE);
+
+    LOG(2, "locate_history_head - newest record in slot %d", lo);
+    return lo;
+}
+
+
+/********************************************************************
+ * read_last_history_record
+ * Read the last history record
+ *
+ * Input:  Handle to weatherstation
+ *         hr - pointer to history_record structure
+ *         outdoor_count - count of additional external sensor
+ *
+ * Output: last history record
+ *
+ * Returns: 0 on success, -1 if the station holds no history
+ *
+ ********************************************************************/
+int read_last_history_record(WEATHERSTATION ws, struct history_record *hr, int outdoor_count) {
+    int last_record_no;
+
+    if ((last_record_no = locate_history_head(ws, outdoor_count)) == -1)
+        return -1;
+
+    return read_history_record(ws, last_record_no, hr, outdoor_count);
+}
+
+
+/********************************************************************
+ * read_error_exit
+ * exit location for all calls to read_safe for error exit.
+ * includes error reporting.
+ *
+ ********************************************************************/
+void read_error_exit(void)
+{
+    perror("read_safe() error");
+    exit(0);
+}
+
+
+/********************************************************************
+ * write_error_exit
+ * exit location for all calls to write_safe for error exit.
+ * includes error reporting.
+ *
+ ********************************************************************/
+void write_error_exit(void)
+{
+    perror("write_safe() error");
+    exit(0);
+}
+
+
+/********************************************************************
+ * get_configuration()
+ *
+ * read setup parameters from ws8610.conf
+ * It searches in this sequence:
+ * 1. Path to config file including filename given as parameter
+ * 2. ./open8610.conf
+ * 3. /usr/local/etc/open8610.conf
+ * 4. /etc/open8610.conf
+ *
+ * See file open8610.conf-dist for the format and option names/values
+ *
+ * input:    config file name with full path - pointer to string
+ *
+ * output:   struct config populated with valid settings either
+ *           from config file or defaults
+ *
+ * returns:  0 = OK
+ *          -1 = no config file or file open error
  *
  ********************************************************************/
 int get_configuration(struct config_type *config, char *path)
@@ -833,6 +1381,14 @@ int get_configuration(struct config_type *config, char *path)
     strcpy(config->pgsql_table, "weather");             // PgSQL table name
     strcpy(config->pgsql_station, "open8610");          // Unique station id
     config->log_level = 0;
+    config->bit_delay = DELAY_CONST;
+    config->read_chunk = READ_CHUNK;
+    config->read_ahead = READ_AHEAD;
+    config->verify = VERIFY_AUTO;
+    config->output_format = SINK_TEXT;
+    strcpy(config->flight_file, RECORDER_DEFAULT_FILE);
+    config->metrics_file[0] = '\0';
+    config->metrics_port = 0;
 
     // open the config file
 
@@ -1004,6 +1560,62 @@ int get_configuration(struct config_type *config, char *path)
             config->log_level = atoi(val);
             continue;
         }
+
+        if ((strcmp(token,"BIT_DELAY")==0) && (strlen(val)!=0))
+        {
+            config->bit_delay = atol(val);
+            continue;
+        }
+
+        if ((strcmp(token,"READ_CHUNK")==0) && (strlen(val)!=0))
+        {
+            config->read_chunk = atoi(val);
+            continue;
+        }
+
+        if ((strcmp(token,"READ_AHEAD") == 0) && (strlen(val) != 0))
+        {
+            config->read_ahead = atoi(val);
+            continue;
+        }
+
+        if ((strcmp(token,"VERIFY") == 0) && (strlen(val) != 0))
+        {
+            if (strcmp(val, "auto") == 0)
+                config->verify = VERIFY_AUTO;
+            else if (strcmp(val, "single") == 0)
+                config->verify = VERIFY_SINGLE;
+            else if (strcmp(val, "double") == 0)
+                config->verify = VERIFY_DOUBLE;
+            else if (strcmp(val, "majority") == 0)
+                config->verify = VERIFY_MAJORITY;
+            continue; //else default remains
+        }
+
+        if ((strcmp(token,"FLIGHT_RECORDER") == 0) && (strlen(val) != 0))
+        {
+            strncpy(config->flight_file, val, sizeof(config->flight_file) - 1);
+            continue;
+        }
+
+        if ((strcmp(token,"METRICS_FILE") == 0) && (strlen(val) != 0))
+        {
+            strncpy(config->metrics_file, val, sizeof(config->metrics_file) - 1);
+            continue;
+        }
+
+        if ((strcmp(token,"METRICS_PORT") == 0) && (strlen(val) != 0))
+        {
+            config->metrics_port = atoi(val);
+            continue;
+        }
+
+        if ((strcmp(token,"OUTPUT_FORMAT") == 0) && (strlen(val) != 0))
+        {
+            if (sink_format(val) != -1)
+                config->output_format = sink_format(val);
+            continue; //else default remains
+        }
     }
 
     return (0);
@@ -1071,6 +1683,27 @@ int write_data(WEATHERSTATION ws, short address, int number, unsigned char *writ
     int i = 1;
     int c, status;
 
+    // A new transaction ends the read a cursor keeps open, a write
+    // also makes its read ahead block stale
+    if (ws->cursor != NULL && writedata != NULL)
+        cursor_close(ws->cursor);
+    else if (ws->cursor != NULL)
+        cursor_stop(ws->cursor);
+
+    // The header snapshot and read ahead records are stale once
+    // written to
+    if (writedata != NULL && address < HEADER_SIZE)
+        ws->header_valid = 0;
+    if (writedata != NULL)
+        flush_record_cache(ws);
+
+    if (ws->transport->write_block != NULL)
+    {
+        if (writedata == NULL)
+            return i;
+        return ws->transport->write_block(ws, address, number, writedata);
+    }
+
     write_byte(ws, command, 1);
     write_byte(ws, address/256, 1);
     write_byte(ws, address%256, 1);
@@ -1078,32 +1711,32 @@ int write_data(WEATHERSTATION ws, short address, int number, unsigned char *writ
     if (writedata!=NULL) {
         for (i = 0; i < number; i++) write_byte(ws, writedata[i], 1);
         set_RTS(ws,1);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
         set_DTR(ws,0);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
         set_RTS(ws,0);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
 
         for (c = 0; c < 3; c++) write_byte(ws, command, 0);
         set_DTR(ws,0);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
         status = get_CTS(ws);
         if (status == 0) i = -1;
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
         set_DTR(ws,1);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
     }
     else {
         set_DTR(ws,0);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
         set_RTS(ws,0);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
         set_RTS(ws,1);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
         set_DTR(ws,1);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
         set_RTS(ws,0);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
     }
 
 //return -1 for errors
@@ -1112,27 +1745,25 @@ int write_data(WEATHERSTATION ws, short address, int number, unsigned char *writ
 
 
 /********************************************************************
- * read_safe Read data, retry until success or maxretries
- * Reads data from the WS8610 based on a given address,
- * number of data read, and a an already open serial port
- * Uses the read_data function and has same interface
+ * read_chunk_double reads one block twice and retries until both
+ * readings are identical or MAXRETRIES is reached
  *
  * Inputs:  ws - device number of the already open serial port
  *          address (interger - 16 bit)
- *          number - number of bytes to read
+ *          number - number of bytes to read, max READ_CHUNK_MAX
  *
  * Output:  readdata - pointer to an array of chars containing
  *                     the just read data, not zero terminated
+ *          mismatches - number of readings that disagreed
  *
- * Returns: number of bytes read, -1 if failed
+ * Returns: number of retries needed, -1 if failed
  *
  ********************************************************************/
-int read_safe(WEATHERSTATION ws, short address, int number, unsigned char *readdata)
+static int read_chunk_double(WEATHERSTATION ws, int address, int number,
+                             unsigned char *readdata, int *mismatches)
 {
-    int i,j;
-    unsigned char readdata2[32768];
-
-    print_log(1,"read_safe");
+    int j;
+    unsigned char readdata2[READ_CHUNK_MAX];
 
     for (j = 0; j < MAXRETRIES; j++)
     {
@@ -1143,56 +1774,660 @@ int read_safe(WEATHERSTATION ws, short address, int number, unsigned char *readd
         read_data(ws, number, readdata2);
 
         if (memcmp(readdata,readdata2,number) == 0)
+            return j;
+
+        LOG(2, "read_safe - two readings not identical");
+        recorder_event(EVENT_MISMATCH, number, address);
+        (*mismatches)++;
+    }
+
+    return -1;
+}
+
+/********************************************************************
+ * read_chunk_single reads one block once and only re-reads the runs
+ * of suspicious bytes, 0x00 and 0xFF being what a stuck or dropped
+ * data line reads as. Other bit errors go unnoticed, so every
+ * VERIFY_SAMPLE-th block is read again in full to keep the mismatch
+ * counters honest. If a re-read disagrees the block falls back to
+ * read_chunk_double. recheck_suspicious does the checking of a block
+ * already read.
+ *
+ * Inputs/Output/Returns: see read_chunk_double
+ *
+ ********************************************************************/
+static int recheck_suspicious(WEATHERSTATION ws, int address, int number,
+                              unsigned char *readdata, int *mismatches)
+{
+    int i, start, end, retries;
+    unsigned char check[READ_CHUNK_MAX];
+
+    if (ws->stats.blocks % VERIFY_SAMPLE == 0)
+    {
+        write_data(ws, address, 0, NULL);
+        read_data(ws, number, check);
+        if (memcmp(readdata, check, number) == 0)
+            return 0;
+        LOG(2, "read_safe - sampled block not identical");
+        recorder_event(EVENT_MISMATCH, number, address);
+        (*mismatches)++;
+        retries = read_chunk_double(ws, address, number, readdata, mismatches);
+        return retries < 0 ? -1 : retries + 1;
+    }
+
+    for (i = 0; i < number; i = end)
+    {
+        if (readdata[i] != 0x00 && readdata[i] != 0xFF)
         {
-            //check if only 0's for reading memory range greater then 10 bytes
-            print_log(2,"read_safe - two readings identical");
-            i = 0;
-            if (number > 10)
-            {
-                for (; readdata[i] == 0 && i < number; i++);
-            }
+            end = i + 1;
+            continue;
+        }
 
-            if (i != number)
+        // Take neighbouring runs along when the gap is cheaper to
+        // read than another address setup
+        start = i;
+        for (end = i; end < number && end - start < READ_CHUNK_MAX; end++)
+        {
+            int k;
+
+            if (readdata[end] == 0x00 || readdata[end] == 0xFF)
+                continue;
+            for (k = end; k < number && k < end + VERIFY_RUN_GAP; k++)
+                if (readdata[k] == 0x00 || readdata[k] == 0xFF)
+                    break;
+            if (k == number || k == end + VERIFY_RUN_GAP)
                 break;
+            end = k;
+        }
+
+        write_data(ws, address + start, 0, NULL);
+        read_data(ws, end - start, check);
+        if (memcmp(readdata + start, check, end - start) != 0)
+        {
+            LOG(2, "read_safe - suspicious bytes not identical");
+            recorder_event(EVENT_MISMATCH, number, address);
+            (*mismatches)++;
+            retries = read_chunk_double(ws, address, number, readdata, mismatches);
+            return retries < 0 ? -1 : retries + 1;
+        }
+    }
+
+    return 0;
+}
+
+static int read_chunk_single(WEATHERSTATION ws, int address, int number,
+                             unsigned char *readdata, int *mismatches)
+{
+    write_data(ws, address, 0, NULL);
+    read_data(ws, number, readdata);
+
+    return recheck_suspicious(ws, address, number, readdata, mismatches);
+}
+
+/********************************************************************
+ * read_chunk_majority reads one block three times and takes the
+ * per byte majority. Only a byte where all three readings differ
+ * makes the block be read again.
+ *
+ * Inputs/Output/Returns: see read_chunk_double
+ *
+ ********************************************************************/
+static int read_chunk_majority(WEATHERSTATION ws, int address, int number,
+                               unsigned char *readdata, int *mismatches)
+{
+    int i, j;
+    unsigned char readdata2[READ_CHUNK_MAX];
+    unsigned char readdata3[READ_CHUNK_MAX];
+
+    for (j = 0; j < MAXRETRIES; j++)
+    {
+        int disagree = 0;
+
+        write_data(ws, address, 0, NULL);
+        read_data(ws, number, readdata);
+        write_data(ws, address, 0, NULL);
+        read_data(ws, number, readdata2);
+        write_data(ws, address, 0, NULL);
+        read_data(ws, number, readdata3);
+
+        for (i = 0; i < number; i++)
+        {
+            if (readdata[i] == readdata2[i] && readdata[i] == readdata3[i])
+                continue;
+            disagree = 1;
+            if (readdata[i] == readdata2[i] || readdata[i] == readdata3[i])
+                continue;
+            if (readdata2[i] == readdata3[i])
+                readdata[i] = readdata2[i];
             else
-                print_log(2,"read_safe - only zeros");
-        } else
-            print_log(2,"read_safe - two readings not identical");
+                break;
+        }
+
+        if (disagree)
+        {
+            LOG(2, "read_safe - three readings not identical");
+            recorder_event(EVENT_MISMATCH, number, address);
+            (*mismatches)++;
+        }
+        if (i == number)
+            return j;
+    }
+
+    return -1;
+}
+
+/* The strategy config.verify selects for the next block */
+static int verify_mode(WEATHERSTATION ws)
+{
+    // Single reads still notice a link getting worse, every
+    // VERIFY_SAMPLE-th block is compared in full
+    if (config.verify != VERIFY_AUTO)
+        return config.verify;
+    if (ws->mismatch_rate < VERIFY_SINGLE_BELOW)
+        return VERIFY_SINGLE;
+    if (ws->mismatch_rate < VERIFY_MAJORITY_ABOVE)
+        return VERIFY_DOUBLE;
+    return VERIFY_MAJORITY;
+}
+
+/* Adds a verified block to the link counters */
+static void count_chunk(WEATHERSTATION ws, int retries, int mismatches)
+{
+    // Running average of blocks that saw any disagreement
+    ws->mismatch_rate += ((mismatches ? 1.0 : 0.0) - ws->mismatch_rate) / VERIFY_RATE_WINDOW;
+    ws->stats.blocks++;
+    ws->retry_count += retries < 0 ? MAXRETRIES : retries;
+    ws->stats.mismatches += mismatches;
+}
+
+/********************************************************************
+ * read_chunk reads one verified block with the strategy configured
+ * in config.verify. VERIFY_AUTO picks one from the mismatch rate
+ * of recent blocks: single reads on a clean link, majority votes on
+ * a noisy one and double reads in between.
+ *
+ * Inputs/Output: see read_chunk_double
+ *
+ * Returns: number of retries needed, -1 if failed
+ *
+ ********************************************************************/
+static int read_chunk(WEATHERSTATION ws, int address, int number, unsigned char *readdata)
+{
+    int mode = verify_mode(ws);
+    int mismatches = 0;
+    int retries;
+
+    if (mode == VERIFY_SINGLE)
+        retries = read_chunk_single(ws, address, number, readdata, &mismatches);
+    else if (mode == VERIFY_MAJORITY)
+        retries = read_chunk_majority(ws, address, number, readdata, &mismatches);
+    else
+        retries = read_chunk_double(ws, address, number, readdata, &mismatches);
+
+    count_chunk(ws, retries, mismatches);
+    return retries;
+}
+
+/********************************************************************
+ * read_safe Read data, retry until success or maxretries
+ * Reads data from the WS8610 based on a given address,
+ * number of data read, and a an already open serial port
+ * Uses the read_data function and has same interface
+ *
+ * The range is read in blocks of config.read_chunk bytes which are
+ * verified on their own, so a corrupted transfer only costs a
+ * re-read of the block it hit. read_safe() times and counts each call
+ * in ws->stats around read_verified(), which does the reading.
+ *
+ * A range of more than 10 bytes that reads as only zeros is taken for
+ * a dead link and read again. read_exact() is read_safe() without that
+ * check, for ranges that may really hold only zeros, e.g. to read back
+ * what write_safe() wrote.
+ *
+ * Inputs:  ws - device number of the already open serial port
+ *          address (interger - 16 bit)
+ *          number - number of bytes to read
+ *
+ * Output:  readdata - pointer to an array of chars containing
+ *                     the just read data, not zero terminated
+ *
+ * Returns: number of bytes read, -1 if failed
+ *
+ ********************************************************************/
+static int read_verified(WEATHERSTATION ws, short address, int number,
+                         unsigned char *readdata, int zeros)
+{
+    int i, j, offset, size, retries, chunks;
+    int chunk_size = config.read_chunk;
+    int total_retries = 0;
+
+    if (chunk_size <= 0 || chunk_size > READ_CHUNK_MAX)
+        chunk_size = READ_CHUNK_MAX;
+    chunks = (number + chunk_size - 1) / chunk_size;
+
+    for (j = 0; j < MAXRETRIES; j++)
+    {
+        for (offset = 0; offset < number; offset += size)
+        {
+            size = number - offset < chunk_size ? number - offset : chunk_size;
+            recorder_event(EVENT_READ_BLOCK, size, address + offset);
+            retries = read_chunk(ws, address + offset, size, readdata + offset);
+            if (retries < 0)
+            {
+                LOG(1, "read_safe - chunk %d/%d at 0x%04X failed after %d retries",
+                    offset / chunk_size + 1, chunks, address + offset, MAXRETRIES);
+                recorder_event(EVENT_READ_FAILED, size, address + offset);
+                if (recorder_dump(RECORDER_READ_FAILED) == 0)
+                    LOG(1, "read_safe - flight recorder written to %s", recorder_file());
+                return -1;
+            }
+            total_retries += retries;
+            LOG(2, "read_safe - chunk %d/%d at 0x%04X, %d bytes, %d retries",
+                offset / chunk_size + 1, chunks, address + offset, size, retries);
+        }
+
+        //check if only 0's for reading memory range greater then 10 bytes
+        LOG(2, "read_safe - two readings identical");
+        i = 0;
+        if (number > 10 && !zeros)
+        {
+            for (; i < number && readdata[i] == 0; i++);
+        }
+
+        if (i != number)
+            break;
+        else
+        {
+            LOG(2, "read_safe - only zeros");
+            ws->stats.zero_rejects++;
+        }
     }
 
     // If we have tried MAXRETRIES times to read we expect not to
     // have valid data
     if (j == MAXRETRIES)
     {
+        recorder_event(EVENT_READ_FAILED, number, address);
+        if (recorder_dump(RECORDER_READ_FAILED) == 0)
+            LOG(1, "read_safe - flight recorder written to %s", recorder_file());
         return -1;
     }
 
+    if (chunks > 1)
+    {
+        LOG(1, "read_safe - %d bytes in %d chunks, %d retries",
+            number, chunks, total_retries);
+    }
+
+    return number;
+}
+
+static int read_timed(WEATHERSTATION ws, short address, int number,
+                      unsigned char *readdata, int zeros)
+{
+    struct timespec start, end;
+    unsigned long retries = ws->retry_count;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ws->transport->read_block != NULL)
+        ret = ws->transport->read_block(ws, address, number, readdata, zeros);
+    else
+        ret = read_verified(ws, address, number, readdata, zeros);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    stats_read_done(&ws->stats, (end.tv_sec - start.tv_sec) * 1000000000LL +
+                    end.tv_nsec - start.tv_nsec, ws->retry_count - retries, ret);
+    return ret;
+}
+
+int read_safe(WEATHERSTATION ws, short address, int number, unsigned char *readdata)
+{
+    LOG(1, "read_safe");
+
+    return read_timed(ws, address, number, readdata, 0);
+}
+
+int read_exact(WEATHERSTATION ws, short address, int number, unsigned char *readdata)
+{
+    LOG(1, "read_exact");
+
+    return read_timed(ws, address, number, readdata, 1);
+}
+
+/********************************************************************
+ * cursor_open
+ * Sets up a cursor for reading on from address with cursor_next().
+ *
+ * The station moves its address pointer on with every byte read, so
+ * a cursor keeps the read transaction open between calls: instead of
+ * an address setup per call, the next call just acknowledges the last
+ * byte and clocks on. Reading records one by one costs one long
+ * transfer. Any other transaction on ws ends the open read; the cursor
+ * then sets its address up again on the next call.
+ *
+ * Bytes are checked like VERIFY_SINGLE reads, re-reading suspicious
+ * runs and sampled blocks, so the cursor only streams while reads are
+ * single. Otherwise, or when the transport serves blocks itself, the
+ * cursor reads ahead a verified block of config.read_chunk bytes with
+ * read_exact() and serves the calls from it until a write.
+ *
+ * Inputs:  cursor - cursor to set up
+ *          ws - device number of the already open serial port
+ *          address - of the first byte to read
+ *
+ ********************************************************************/
+void cursor_open(struct read_cursor *cursor, WEATHERSTATION ws, int address)
+{
+    cursor->ws = ws;
+    cursor->address = address & 0x7FFF;
+    cursor->streaming = 0;
+    cursor->buffer_length = 0;
+}
+
+/* Moves the cursor, ending its read unless it already is at address */
+void cursor_seek(struct read_cursor *cursor, int address)
+{
+    if ((address & 0x7FFF) != cursor->address)
+    {
+        cursor_stop(cursor);
+        cursor->address = address & 0x7FFF;
+    }
+}
+
+/* Ends the read the cursor keeps open, keeping its read ahead block */
+static void cursor_stop(struct read_cursor *cursor)
+{
+    if (cursor->streaming)
+    {
+        cursor->streaming = 0;
+        read_last_byte_seq(cursor->ws);
+    }
+}
+
+/* Makes cursor the one ws ends on the next transaction */
+static void cursor_register(struct read_cursor *cursor)
+{
+    if (cursor->ws->cursor != NULL && cursor->ws->cursor != cursor)
+        cursor_close(cursor->ws->cursor);
+    cursor->ws->cursor = cursor;
+}
+
+/* Ends the read the cursor keeps open and drops its read ahead block,
+ * must be called when done */
+void cursor_close(struct read_cursor *cursor)
+{
+    if (cursor->ws->cursor == cursor)
+        cursor->ws->cursor = NULL;
+    cursor_stop(cursor);
+    cursor->buffer_length = 0;
+}
+
+/* Serves number bytes from the read ahead block, reading the next
+ * block when they are not in it, -1 on read error */
+static int cursor_buffered(struct read_cursor *cursor, int number, unsigned char *readdata)
+{
+    WEATHERSTATION ws = cursor->ws;
+    int offset = cursor->address - cursor->buffer_address;
+    int size = config.read_chunk;
+
+    cursor_stop(cursor);
+    if (cursor->buffer_length == 0 || offset < 0 ||
+        offset + number > cursor->buffer_length)
+    {
+        if (size < number)
+            size = number;
+        if (size > READ_CHUNK_MAX)
+            size = READ_CHUNK_MAX;
+        if (size > 0x8000 - cursor->address)
+            size = 0x8000 - cursor->address;
+        cursor->buffer_length = 0;
+        if (size < number)
+        {
+            // Wraps around the end of memory or does not fit
+            if (read_exact(ws, cursor->address, number, readdata) != number)
+                return -1;
+            cursor->address = (cursor->address + number) & 0x7FFF;
+            return number;
+        }
+        if (read_exact(ws, cursor->address, size, cursor->buffer) != size)
+            return -1;
+        cursor->buffer_address = cursor->address;
+        cursor->buffer_length = size;
+        cursor_register(cursor);
+        offset = 0;
+    }
+
+    memcpy(readdata, cursor->buffer + offset, number);
+    cursor->address = (cursor->address + number) & 0x7FFF;
+    return number;
+}
+
+/* Clocks number bytes on from the cursor, -1 if the station did not
+ * acknowledge the read command */
+static int cursor_stream(struct read_cursor *cursor, int number, unsigned char *readdata)
+{
+    WEATHERSTATION ws = cursor->ws;
+    int i;
+
+    for (i = 0; i < number; i++)
+    {
+        if (!cursor->streaming)
+        {
+            write_data(ws, cursor->address, 0, NULL);
+            if (!write_byte(ws, 0xa1, 1))
+            {
+                read_last_byte_seq(ws);
+                return -1;
+            }
+            cursor->streaming = 1;
+            cursor_register(cursor);
+        }
+        else
+            read_next_byte_seq(ws);
+        readdata[i] = read_byte(ws);
+        cursor->address = (cursor->address + 1) & 0x7FFF;
+    }
+    return 0;
+}
+
+/********************************************************************
+ * cursor_next
+ * Reads the next bytes from a cursor
+ *
+ * Inputs:  cursor - cursor set up by cursor_open()
+ *          number - number of bytes to read
+ *
+ * Output:  readdata - pointer to an array of chars containing
+ *                     the just read data, not zero terminated
+ *
+ * Returns: number of bytes read, -1 if failed
+ *
+ ********************************************************************/
+int cursor_next(struct read_cursor *cursor, int number, unsigned char *readdata)
+{
+    WEATHERSTATION ws = cursor->ws;
+    int chunk_size = config.read_chunk;
+    int offset, size, address, i, retries, mismatches;
+    unsigned long retry_count = ws->retry_count;
+    struct timespec start, end;
+
+    if (ws->transport->read_block != NULL || verify_mode(ws) != VERIFY_SINGLE)
+        return cursor_buffered(cursor, number, readdata);
+    cursor->buffer_length = 0;
+
+    LOG(1, "cursor_next - %d bytes at 0x%04X%s", number, cursor->address,
+        cursor->streaming ? ", streaming" : "");
+
+    if (chunk_size <= 0 || chunk_size > READ_CHUNK_MAX)
+        chunk_size = READ_CHUNK_MAX;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (offset = 0; offset < number; offset += size)
+    {
+        size = number - offset < chunk_size ? number - offset : chunk_size;
+        address = cursor->address;
+        recorder_event(EVENT_READ_BLOCK, size, address);
+
+        mismatches = 0;
+        if (cursor_stream(cursor, size, readdata + offset) < 0)
+        {
+            retries = read_chunk_double(ws, address, size, readdata + offset, &mismatches);
+            cursor->address = (address + size) & 0x7FFF;
+        }
+        else
+        {
+            for (i = 0; i < size && readdata[offset + i] != 0x00 &&
+                 readdata[offset + i] != 0xFF; i++)
+                ;
+            retries = 0;
+            if (i < size || ws->stats.blocks % VERIFY_SAMPLE == 0)
+            {
+                cursor_close(cursor);
+                retries = recheck_suspicious(ws, address, size, readdata + offset, &mismatches);
+            }
+        }
+        count_chunk(ws, retries, mismatches);
+
+        if (retries < 0)
+        {
+            LOG(1, "cursor_next - block at 0x%04X failed after %d retries",
+                address, MAXRETRIES);
+            cursor_close(cursor);
+            recorder_event(EVENT_READ_FAILED, size, address);
+            if (recorder_dump(RECORDER_READ_FAILED) == 0)
+                LOG(1, "cursor_next - flight recorder written to %s", recorder_file());
+            number = -1;
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    stats_read_done(&ws->stats, (end.tv_sec - start.tv_sec) * 1000000000LL +
+                    end.tv_nsec - start.tv_nsec, ws->retry_count - retry_count, number);
     return number;
 }
 
+/********************************************************************
+ * write_safe Write data, verify and retry until success or maxretries
+ * Makes the station memory from address on equal to writedata, e.g.
+ * the alarm thresholds at 0x21-0x4A, while writing as little as
+ * possible: only bytes that differ from current are written.
+ *
+ * Changed bytes less than VERIFY_RUN_GAP apart are sent as one
+ * write_data() transaction, rewriting the unchanged bytes between them,
+ * as that is cheaper than another command and address. No transaction
+ * crosses a WRITE_PAGE boundary. Each one is read back on its own and
+ * written again if it did not take.
+ *
+ * Inputs:  ws - device number of the already open serial port
+ *          address (interger - 16 bit)
+ *          number - number of bytes to write
+ *          writedata - the wanted memory contents
+ *          current - what the memory is known to hold, e.g. an earlier
+ *                    read_exact() of the range, updated with what was
+ *                    read back. NULL to read the range first.
+ *
+ * Returns: number of bytes written, 0 if the memory already matched,
+ *          -1 if failed
+ *
+ ********************************************************************/
+int write_safe(WEATHERSTATION ws, short address, int number,
+               unsigned char *writedata, unsigned char *current)
+{
+    unsigned char readback[WRITE_PAGE];
+    unsigned char *known = current;
+    int start, end, i, j, pending = 1;
+    int written = 0;
+
+    LOG(1, "write_safe");
+
+    if (known == NULL)
+    {
+        if ((known = malloc(number)) == NULL)
+            return -1;
+        if (read_exact(ws, address, number, known) != number)
+        {
+            free(known);
+            return -1;
+        }
+    }
+
+    for (j = 0; j < MAXRETRIES && pending; j++)
+    {
+        pending = 0;
+        for (start = 0; start < number; start = end)
+        {
+            if (known[start] == writedata[start])
+            {
+                end = start + 1;
+                continue;
+            }
+
+            // Grow the run while the next change is close enough and
+            // in the same page
+            end = start + 1;
+            for (i = end; i < number && i - end < VERIFY_RUN_GAP &&
+                 (address + i) / WRITE_PAGE == (address + start) / WRITE_PAGE; i++)
+            {
+                if (known[i] != writedata[i])
+                    end = i + 1;
+            }
+
+            LOG(2, "write_safe - %d bytes at 0x%04X", end - start, address + start);
+            if (write_data(ws, address + start, end - start, writedata + start) < 0)
+                LOG(2, "write_safe - no acknowledge at 0x%04X", address + start);
+            written += end - start;
+
+            if (read_exact(ws, address + start, end - start, readback) != end - start)
+            {
+                pending = -1;
+                break;
+            }
+            memcpy(known + start, readback, end - start);
+            if (memcmp(readback, writedata + start, end - start) != 0)
+            {
+                LOG(1, "write_safe - 0x%04X read back wrong", address + start);
+                pending = 1;
+            }
+        }
+        if (pending < 0)
+            break;
+    }
+
+    if (known != current)
+        free(known);
+
+    if (pending)
+        return -1;
+
+    LOG(1, "write_safe - %d of %d bytes written", written, number);
+    return written;
+}
+
 void read_next_byte_seq(WEATHERSTATION ws)
 {
-    print_log(3,"read_next_byte_seq");
+    LOG(3, "read_next_byte_seq");
     write_bit(ws,0);
     set_RTS(ws,0);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
 }
 
 void read_last_byte_seq(WEATHERSTATION ws)
 {
-    print_log(3,"read_last_byte_seq");
+    LOG(3, "read_last_byte_seq");
     set_RTS(ws,1);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
     set_DTR(ws,0);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
     set_RTS(ws,0);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
     set_RTS(ws,1);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
     set_DTR(ws,1);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
     set_RTS(ws,0);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
 }
 
 /********************************************************************
@@ -1208,17 +2443,15 @@ void read_last_byte_seq(WEATHERSTATION ws)
 int read_bit(WEATHERSTATION ws)
 {
     int status;
-    char str[20];
 
-    print_log(4, "Read bit...");
+    LOG(4, "Read bit...");
     set_DTR(ws,0);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
     status = get_CTS(ws);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
     set_DTR(ws,1);
-    nanodelay(DELAY_CONST);
-    sprintf(str, "bit = %i",!status);
-    print_log(4,str);
+    nanodelay(config.bit_delay);
+    LOG_TRACE(4, TRACE_READ_BIT, !status);
 
     return !status;
 }
@@ -1235,16 +2468,11 @@ int read_bit(WEATHERSTATION ws)
  ********************************************************************/
 void write_bit(WEATHERSTATION ws,short bit)
 {
-    char str[20];
-    int val = 0;
-
-    if (bit) val = 1;
-    sprintf(str, "Write bit %i", val);
-    print_log(4,str);
+    LOG_TRACE(4, TRACE_WRITE_BIT, bit != 0);
     set_RTS(ws,!bit);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
     set_DTR(ws,0);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
     set_DTR(ws,1);
 }
 
@@ -1263,16 +2491,16 @@ unsigned char read_byte(WEATHERSTATION serdevice)
 {
     unsigned char byte = 0;
     int i;
-    char str[20];
 
-    print_log(3, "Read byte...");
+    LOG(3, "Read byte...");
     for (i = 0; i < 8; i++)
     {
         byte *= 2;
         byte += read_bit(serdevice);
     }
-    sprintf(str, "byte = %X", byte);
-    print_log(3, str);
+    recorder_event(EVENT_READ_BYTE, byte, 0);
+    LOG_TRACE(3, TRACE_READ_BYTE, byte);
+    serdevice->stats.line_bytes++;
 
     return byte;
 }
@@ -1292,10 +2520,9 @@ int write_byte(WEATHERSTATION ws, unsigned char byte, int check_value)
 {
     int status = 1;
     int i;
-    char str[20];
+    unsigned char sent = byte;
 
-    sprintf(str, "Write byte %X", byte);
-    print_log(3,str);
+    LOG_TRACE(3, TRACE_WRITE_BYTE, byte);
 
     for (i = 0; i < 8; i++)
     {
@@ -1305,16 +2532,18 @@ int write_byte(WEATHERSTATION ws, unsigned char byte, int check_value)
     }
 
     set_RTS(ws,0);
-    nanodelay(DELAY_CONST);
+    nanodelay(config.bit_delay);
+    ws->stats.line_bytes++;
     if (check_value == 1) {
         status = get_CTS(ws);
         //TODO: checking value of status, error routine
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
         set_DTR(ws,0);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
         set_DTR(ws,1);
-        nanodelay(DELAY_CONST);
+        nanodelay(config.bit_delay);
     }
+    recorder_event(EVENT_WRITE_BYTE, sent, status != 0);
     if (status)
         return 1;
     else
@@ -1351,3 +2580,50 @@ void print_log(int log_level, char* str)
     if (log_level <= config.log_level)
         fprintf(stderr,"%s\n",str);
 }
+
+/********************************************************************
+ * log_printf
+ * Writes a formatted log message, called through LOG() once the level
+ * has been checked
+ *
+ * Inputs:  format, ... - as printf
+ *
+ ********************************************************************/
+void log_printf(const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+/********************************************************************
+ * log_trace
+ * Writes a protocol trace event, called through LOG_TRACE() once the
+ * level has been checked
+ *
+ * Inputs:  event - TRACE_ event
+ *          value - bit, byte or line level
+ *
+ ********************************************************************/
+void log_trace(int event, int value)
+{
+    static const char *formats[] = {
+        [TRACE_READ_BIT] = "bit = %i",
+        [TRACE_WRITE_BIT] = "Write bit %i",
+        [TRACE_READ_BYTE] = "byte = %X",
+        [TRACE_WRITE_BYTE] = "Write byte %X",
+        [TRACE_SET_DTR] = "%s DTR",
+        [TRACE_SET_RTS] = "%s RTS",
+        [TRACE_GET_DSR] = "Got DSR = %i",
+        [TRACE_GET_CTS] = "Got CTS = %i",
+    };
+
+    if (event == TRACE_SET_DTR || event == TRACE_SET_RTS)
+        fprintf(stderr, formats[event], value ? "Set" : "Clear");
+    else
+        fprintf(stderr, formats[event], value);
+    fputc('\n', stderr);
+}
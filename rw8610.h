@@ -8,6 +8,9 @@
 #define _INCLUDE_RW8610_H_
 
 #include "linux8610.h"
+#include "clock8610.h"
+#include "sink8610.h"
+#include "stats8610.h"
 
 #include <string.h>
 #include <fcntl.h>
@@ -15,12 +18,31 @@
 #include <time.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
 #include <math.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 
 #define MAXRETRIES          20
+#define READ_CHUNK          256     //default bytes verified per block
+#define READ_CHUNK_MAX      32768
+#define READ_AHEAD          32      //default history records read ahead
+#define READ_AHEAD_MAX      256
+#define RECORD_CACHE_WINDOWS 4      //read ahead windows kept, least recently used goes
+#define RECORD_CACHE_NO_WALK (-0x10000) //record_cache_next no address follows
+#define VERIFY_AUTO         0
+#define VERIFY_SINGLE       1       //one read, re-read of 0x00/0xFF runs
+#define VERIFY_DOUBLE       2       //two reads compared
+#define VERIFY_MAJORITY     3       //three reads, per byte majority
+#define VERIFY_SINGLE_BELOW 0.01    //auto: mismatch rate to use single reads
+#define VERIFY_MAJORITY_ABOVE 0.1   //auto: mismatch rate to use majority votes
+#define VERIFY_RATE_WINDOW  16      //blocks averaged into the mismatch rate
+#define VERIFY_RATE_START   0.05    //start out with double reads
+#define VERIFY_SAMPLE       16      //single: every 16th block is read twice in full
+#define VERIFY_RUN_GAP      4       //gap bytes cheaper than a new address setup
+#define WRITE_PAGE          64      //EEPROM page, one write must stay inside
 #define MAXWINDRETRIES      20
 #define WRITENIB            0x42
 #define SETBIT              0x12
@@ -42,8 +64,33 @@
 #define MILLIBARS           1.0
 #define INCHES_HG           33.8638864
 
+#define HEADER_SIZE         0x064   //station settings below the history ring
+#define HEADER_MAX_AGE      10      //seconds a header snapshot serves accessors
+#define HISTORY_COUNT_ADR   0x009
 #define HISTORY_BUFFER_ADR  0x064
 #define HISTORY_BUFFER_SIZE (0x7FFF - HISTORY_BUFFER_ADR)
+/* Fields of a history record as nibble offsets from its start, nibble
+ * 2n being the low nibble of byte n. Temperatures are three BCD digits,
+ * tenths first, offset by 30 degrees; humidities are two BCD digits. */
+#define RECORD_T0_NIBBLE    10      // indoor
+#define RECORD_T1_NIBBLE    13      // outdoor
+#define RECORD_RH0_NIBBLE   16
+#define RECORD_RH1_NIBBLE   18
+#define RECORD_T2_NIBBLE    20      // second outdoor, 13 and 15 byte records
+#define RECORD_RH2_NIBBLE   23
+#define RECORD_T3_NIBBLE    25      // third outdoor, 15 byte records only
+#define RECORD_RH3_NIBBLE   28
+#define RECORD_TEMP_INVALID 81.0    // what temp2str() and RH2str() show as "-",
+#define RECORD_TENTHS_INVALID 810   // the digits read AAA or AA when there
+#define RECORD_RH_INVALID   110     // is no sensor
+
+#define PACKED_RECORD_SIZE  20      // bytes per record in archive files
+#define PACKED_TEMP_VALID(ch)   (0x01 << (ch))
+#define PACKED_RH_VALID(ch)     (0x10 << (ch))
+
+#define HISTORY_STAMP_SIZE  5       // minute, hour, day, month, year in BCD
+#define HISTORY_FOLLOW_MAX  4       // new records followed from a cached head
+                                    // before searching the ring again
 
 /* ONLY EDIT THESE IF WEATHER UNDERGROUND CHANGES URL */
 #define WEATHER_UNDERGROUND_BASEURL "weatherstation.wunderground.com"
@@ -82,6 +129,14 @@ struct config_type
     char   pgsql_table[25];
     char   pgsql_station[25];
     int    log_level;
+    long   bit_delay;                  //ns between modem line transitions
+    int    read_chunk;                 //bytes per verified block of read_safe
+    int    read_ahead;                 //history records read per cache miss
+    int    verify;                     //VERIFY_ strategy of read_safe
+    int    output_format;              //SINK_ format of the tools' output
+    char   flight_file[256];           //where the flight recorder is dumped
+    char   metrics_file[256];          //textfile collector file, "" = none
+    int    metrics_port;               //open8610d metrics HTTP port, 0 = off
 };
 
 struct timestamp
@@ -93,6 +148,22 @@ struct timestamp
     int year;
 };
 
+/* Snapshot of the station memory below the history ring, 0x00-0x63,
+ * read in one transfer. Fields without a decoded member are in data. */
+struct station_header
+{
+    time_t time;                        //station clock (0x00-0x05)
+    int channels;                       //active sensor channels (0x08)
+    int record_count;                   //history records stored (0x09-0x0A)
+    int loop_flags;                     //0x0B, changes once the ring wrapped
+    int outdoor_count;                  //additional outdoor sensors recorded
+    int record_flags;                   //high nibble of 0x0C
+    time_t download_time;               //last PC download (0x51-0x58), 0 = none
+    long download_records;              //records it fetched (0x59-0x5C)
+    int download_sensors;               //sensors recorded then (0x5D)
+    unsigned char data[HEADER_SIZE];
+};
+
 struct history_record
 {
     time_t time_stamp;
@@ -100,6 +171,109 @@ struct history_record
     int    RH[4];
 };
 
+/* Compact form of a history record, used for records kept in memory
+ * and, little endian, for archive files. Readings without a sensor
+ * are 0 with their valid bit clear. */
+struct packed_record
+{
+    uint32_t time;                      //seconds since 1/1/1970 UTC
+    int16_t  temp[4];                   //tenths of a degree Celsius
+    uint8_t  rh[4];                     //percent
+    uint8_t  valid;                     //PACKED_TEMP_VALID, PACKED_RH_VALID bits
+    uint8_t  reserved[3];
+};
+
+/* A history record format. There is one per count of additional
+ * outdoor sensors; channel 0 is indoor, 1 to 3 are the outdoor
+ * sensors. Channels a format does not store decode as invalid. */
+struct record_layout
+{
+    int length;                         //bytes per record
+    int record_max;                     //records in the ring buffer
+    int channels;                       //temperature/humidity pairs stored
+    int temp_nibble[4];                 //RECORD_T*_NIBBLE of each channel
+    int rh_nibble[4];                   //RECORD_RH*_NIBBLE of each channel
+    void (*decode)(unsigned char *record, struct station_clock *sc,
+                   struct packed_record *pr);
+};
+
+/* History records read ahead of read_history_packed() */
+struct record_window
+{
+    int address;                        //station address of data[0]
+    int length;                         //bytes held, 0 = empty
+    unsigned long used;                 //cache tick of the last hit
+    unsigned char key[3];               //history count 0x09-0x0B it was read under
+    unsigned char data[READ_AHEAD_MAX * 16];
+};
+
+/* A read position that keeps one read transaction of the station open
+ * across calls, see cursor_open() */
+struct read_cursor
+{
+    WEATHERSTATION ws;
+    int address;                        //of the next byte
+    int streaming;                      //a read transaction is open
+    int buffer_address;                 //verified block read ahead, if not
+    int buffer_length;                  //streaming
+    unsigned char buffer[READ_CHUNK_MAX];
+};
+
+/* A transport moves the modem control lines the station protocol is
+ * clocked over. The serial transport drives a real tty, other transports
+ * are selected by a "prefix:" in front of the device name (sim: for the
+ * simulator, image: for a captured station image, unix: for a station
+ * served by open8610d). */
+struct transport8610
+{
+    const char *prefix;         //device name prefix, NULL for the default
+    int  (*open)(WEATHERSTATION ws, char *device);
+    void (*close)(WEATHERSTATION ws);
+    void (*set_DTR)(WEATHERSTATION ws, int val);
+    void (*set_RTS)(WEATHERSTATION ws, int val);
+    int  (*get_DSR)(WEATHERSTATION ws);
+    int  (*get_CTS)(WEATHERSTATION ws);
+    int  (*read_device)(WEATHERSTATION ws, unsigned char *buffer, int size);
+    int  (*write_device)(WEATHERSTATION ws, unsigned char *buffer, int size);
+    // Optional, transports that hold the station memory themselves
+    // serve read_safe() directly and skip the connect handshake. zeros
+    // is set for read_exact(), an all-zero range is then valid data
+    int  (*read_block)(WEATHERSTATION ws, int address, int number,
+                       unsigned char *readdata, int zeros);
+    int  (*write_block)(WEATHERSTATION ws, int address, int number, unsigned char *writedata);
+    // Optional, sleeps until DSR reaches level or timeout_ms passed.
+    // Returns 1 when reached, 0 on timeout, -1 if the port cannot wait
+    // for modem line changes (then DSR is polled instead)
+    int  (*wait_DSR)(WEATHERSTATION ws, int level, long timeout_ms);
+};
+
+struct weatherstation
+{
+    int fd;                                 //serial file descriptor
+    const struct transport8610 *transport;
+    void *transport_data;                   //private state of the transport
+    int lines;                              //shadow of DTR/RTS (TIOCM_ bits)
+    int lines_valid;                        //shadow holds the real line state
+    double mismatch_rate;                   //share of recent blocks read unequal
+    unsigned long retry_count;              //times one of them was read again
+    long long connect_ns;                   //whole open_weatherstation() time
+    long long dsr_rise_ns;                  //station answering the handshake
+    long long dsr_fall_ns;                  //station ending the handshake
+    struct link_stats stats;                //counters for METRICS_FILE/PORT
+    struct station_header header;           //last header snapshot
+    int header_valid;                       //header may serve accessors
+    struct read_cursor *cursor;             //cursor with an open read or block, if any
+    struct record_window record_cache[RECORD_CACHE_WINDOWS];
+    unsigned long record_cache_tick;
+    int record_cache_next;                  //address after the last miss
+    unsigned char record_cache_key[3];      //newest history count 0x09-0x0B seen
+    long long record_cache_ns;              //full ring: header_ns it is for
+    long long header_ns;                    //monotonic time it was read
+    int history_head;                       //slot of the newest history record
+    int history_head_length;                //its record length, 0 = not known
+    unsigned char history_head_stamp[HISTORY_STAMP_SIZE];
+};
+
 //calibration value for nanodelay function
 extern float spins_per_ns;
 
@@ -115,9 +289,27 @@ char *RH2str(int RH, char *frmt, char *str);
 time_t current_timestamp(WEATHERSTATION ws);
 int outdoor_count(WEATHERSTATION ws);
 int get_history_record_length(int outdoor_count);
+int get_history_record_max(int outdoor_count);
+
+const struct record_layout *get_record_layout(int outdoor_count);
+
+void unpack_record(struct packed_record *pr, struct history_record *hr);
+
+void sink_history_fields(struct sink *sink, struct history_record *hr, int channels);
+
+void decode_packed_records(const struct record_layout *layout, unsigned char *data,
+                           int count, struct station_clock *sc,
+                           struct packed_record *out);
+
+int write_packed_records(FILE *fileptr, struct packed_record *records, int count);
+
+int read_packed_records(FILE *fileptr, struct packed_record *records, int count);
 
 int hist_mins(unsigned char *data);
 int hist_hours(unsigned char *data);
+time_t hist_timestamp(unsigned char *data);
+
+time_t hist_timestamp_clock(struct station_clock *sc, unsigned char *data);
 int history_length(unsigned char *data);
 
 double pressure_conv(double pressure_hpa);
@@ -264,14 +456,22 @@ double calculate_windchill(double temperature, double windspeed);
 
 void tendency_forecast(unsigned char *data, char *tendency, char *forecast);
 
-int read_history_info(WEATHERSTATION ws2300, int *interval, int *countdown,
-                      struct timestamp *time_last, int *no_records);
+int read_history_info(WEATHERSTATION ws, struct station_header *header);
+
+const struct station_header *station_header(WEATHERSTATION ws);
+
+int read_history_packed(WEATHERSTATION ws,
+                        int record_no,
+                        struct packed_record *pr,
+                        int outdoor_count);
 
 int read_history_record(WEATHERSTATION ws,
                         int record_no,
                         struct history_record *hr,
                         int outdoor_count);
 
+int locate_history_head(WEATHERSTATION ws, int outdoor_count);
+
 int read_last_history_record(WEATHERSTATION ws,
                              struct history_record *hr,
                              int outdoor_count);
@@ -291,20 +491,9 @@ int get_configuration(struct config_type *, char *path);
 
 WEATHERSTATION open_weatherstation(char *device);
 
-void close_weatherstation(WEATHERSTATION ws);
-
-void address_encoder(int address_in, unsigned char *address_out);
-
-void data_encoder(int number, unsigned char encode_constant,
-                  unsigned char *data_in, unsigned char *data_out);
-
-unsigned char numberof_encoder(int number);
+WEATHERSTATION try_open_weatherstation(char *device);
 
-unsigned char command_check0123(unsigned char *command, int sequence);
-
-unsigned char command_check4(int number);
-
-unsigned char data_checksum(unsigned char *data, int number);
+void close_weatherstation(WEATHERSTATION ws);
 
 int initialize(WEATHERSTATION ws2300);
 
@@ -316,9 +505,15 @@ int write_data(WEATHERSTATION ws, short address, int number, unsigned char *writ
 
 int read_safe(WEATHERSTATION ws2300, short address, int number, unsigned char *readdata);
 
-int write_safe(WEATHERSTATION ws2300, short address, int number,
-               unsigned char encode_constant, unsigned char *writedata,
-               unsigned char *commanddata);
+int read_exact(WEATHERSTATION ws, short address, int number, unsigned char *readdata);
+
+void cursor_open(struct read_cursor *cursor, WEATHERSTATION ws, int address);
+void cursor_seek(struct read_cursor *cursor, int address);
+int cursor_next(struct read_cursor *cursor, int number, unsigned char *readdata);
+void cursor_close(struct read_cursor *cursor);
+
+int write_safe(WEATHERSTATION ws, short address, int number,
+               unsigned char *writedata, unsigned char *current);
 
 void read_next_byte_seq(WEATHERSTATION ws);
 void read_last_byte_seq(WEATHERSTATION ws);
@@ -328,8 +523,37 @@ void write_bit(WEATHERSTATION ws,short bit);
 unsigned char read_byte(WEATHERSTATION ws);
 int write_byte(WEATHERSTATION ws, unsigned char byte, int check_value);
 void print_log(int log_level, char* str);
+void log_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void log_trace(int event, int value);
+
+/* Logging. Messages above LOG_LEVEL_MAX (set at build time) compile
+ * out; the others check config.log_level before their arguments are
+ * evaluated, so a disabled message costs one compare. Protocol events
+ * on the bit and byte level are passed to log_trace as an event number
+ * and a value and only formatted when they are written. */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX       5
+#endif
+
+#define LOG_ENABLED(level)  ((level) <= LOG_LEVEL_MAX && (level) <= config.log_level)
+
+#define LOG(level, ...) \
+    do { if (LOG_ENABLED(level)) log_printf(__VA_ARGS__); } while (0)
+
+#define LOG_TRACE(level, event, value) \
+    do { if (LOG_ENABLED(level)) log_trace(event, value); } while (0)
+
+#define TRACE_READ_BIT      0
+#define TRACE_WRITE_BIT     1
+#define TRACE_READ_BYTE     2
+#define TRACE_WRITE_BYTE    3
+#define TRACE_SET_DTR       4
+#define TRACE_SET_RTS       5
+#define TRACE_GET_DSR       6
+#define TRACE_GET_CTS       7
 
 /* Platform dependent functions */
+extern const struct transport8610 serial_transport;
 int read_device(WEATHERSTATION serdevice, unsigned char *buffer, int size);
 int write_device(WEATHERSTATION serdevice, unsigned char *buffer, int size);
 //void sleep_very_short(int n);
@@ -0,0 +1,388 @@
+/*  open8610  - sim8610 station simulator
+ *  This file contains an in-process emulation of the WS-8610 serial
+ *  interface so the protocol in rw8610.c can be run, profiled and
+ *  regression tested without a station attached.
+ *
+ *  The station memory is a 32 KB serial EEPROM clocked over the modem
+ *  control lines: DTR is the inverted clock, RTS the inverted data line
+ *  driven by the host and CTS the inverted data line driven by the
+ *  station. A falling data line while the clock is high starts a
+ *  transaction, a rising one stops it. 0xa0 followed by two address
+ *  bytes sets the address (and writes any following bytes), 0xa1
+ *  reads sequentially from the current address.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "sim8610.h"
+
+enum sim_phase
+{
+    SIM_IDLE,       // waiting for a start condition
+    SIM_RX,         // receiving command, address or data bytes
+    SIM_TX,         // sending memory contents
+    SIM_BUSY        // write cycle, answering write_data() polling
+};
+
+struct sim_state
+{
+    unsigned char memory[SIM_MEMORY_SIZE];
+    int scl;                // clock line level (inverse of DTR)
+    int sda;                // data line level driven by host (inverse of RTS)
+    int sda_out;            // data line level driven by station, 1 = released
+    enum sim_phase phase;
+    int bitcnt;             // bits of the current byte clocked so far
+    int ack_slot;           // 1 while the station drives an acknowledge
+    int byte_index;         // bytes received since start condition
+    unsigned char shift;
+    int read_pending;       // read command acknowledged, send on next clock
+    int master_ack;
+    int address;
+    unsigned char page[SIM_PAGE_SIZE];
+    int page_count;
+    int dsr_polls;
+    double noise;           // chance of a CTS read returning the wrong level
+    unsigned long long random;
+};
+
+
+/********************************************************************
+ * sim_load_image
+ * Seeds a memory image from a text file. Both the annotated memory
+ * map format ("Address: 0064 - Data: 30 ...") and the dump8610 file
+ * format ("0060: 00 FF FF ...") are understood. Bytes not mentioned
+ * in the file read as 0xFF like unused station memory.
+ *
+ * Input:   memory - SIM_MEMORY_SIZE bytes buffer
+ *          filename - file to read
+ *
+ * Returns: number of bytes loaded, -1 if the file cannot be opened
+ *
+ ********************************************************************/
+int sim_load_image(unsigned char *memory, char *filename)
+{
+    FILE *fptr;
+    char inputline[1000];
+    unsigned int address, data;
+    int count = 0;
+
+    memset(memory, 0xFF, SIM_MEMORY_SIZE);
+
+    if ((fptr = fopen(filename, "r")) == NULL)
+        return -1;
+
+    while (fgets(inputline, sizeof(inputline), fptr) != NULL)
+    {
+        char *p;
+        int n = 0;
+
+        if (sscanf(inputline, "Address: %x - Data: %x", &address, &data) == 2)
+        {
+            memory[address % SIM_MEMORY_SIZE] = data;
+            count++;
+            continue;
+        }
+
+        if (sscanf(inputline, "%x:%n", &address, &n) != 1 || n == 0)
+            continue;
+        for (p = inputline + n; sscanf(p, " %2x%n", &data, &n) == 1; p += n)
+        {
+            memory[address++ % SIM_MEMORY_SIZE] = data;
+            count++;
+        }
+    }
+
+    fclose(fptr);
+    return count;
+}
+
+/********************************************************************
+ * sim_memory
+ * Gives access to the memory of a simulated station
+ *
+ * Input:   ws - handle to a station opened on the sim transport
+ *
+ * Returns: pointer to SIM_MEMORY_SIZE bytes
+ *
+ ********************************************************************/
+unsigned char *sim_memory(WEATHERSTATION ws)
+{
+    return ((struct sim_state *)ws->transport_data)->memory;
+}
+
+/********************************************************************
+ * sim_set_noise
+ * Makes CTS reads return the wrong level now and then, like a marginal
+ * serial link
+ *
+ * Inputs:  ws - handle to a simulated weatherstation
+ *          rate - chance of each CTS read being wrong, 0 for none
+ *          seed - seed of the pseudo random sequence
+ *
+ ********************************************************************/
+void sim_set_noise(WEATHERSTATION ws, double rate, unsigned long seed)
+{
+    struct sim_state *sim = ws->transport_data;
+
+    sim->noise = rate;
+    sim->random = seed * 0x9E3779B97F4A7C15ULL + 1;
+}
+
+
+/* Latches a byte received from the host and decides on the acknowledge */
+static void sim_byte_received(struct sim_state *sim)
+{
+    unsigned char byte = sim->shift;
+    int ack = 1;
+
+    switch (sim->byte_index)
+    {
+    case 0:
+        if ((byte & 0xFE) != 0xa0)
+            ack = 0;
+        else if (byte & 1)
+            sim->read_pending = 1;
+        break;
+    case 1:
+        sim->address = (byte << 8) & (SIM_MEMORY_SIZE - 1);
+        break;
+    case 2:
+        sim->address |= byte;
+        break;
+    default:
+        if (sim->page_count < SIM_PAGE_SIZE)
+            sim->page[sim->page_count++] = byte;
+        else
+            ack = 0;
+        break;
+    }
+
+    sim->byte_index++;
+    sim->sda_out = !ack;
+    sim->ack_slot = 1;
+    if (!ack)
+        sim->phase = SIM_IDLE;
+}
+
+static void sim_start(struct sim_state *sim)
+{
+    sim->phase = SIM_RX;
+    sim->bitcnt = 0;
+    sim->ack_slot = 0;
+    sim->byte_index = 0;
+    sim->read_pending = 0;
+    sim->page_count = 0;
+    sim->sda_out = 1;
+}
+
+static void sim_stop(struct sim_state *sim)
+{
+    int i;
+
+    sim->sda_out = 1;
+    if (sim->phase == SIM_RX && sim->page_count > 0)
+    {
+        for (i = 0; i < sim->page_count; i++)
+            sim->memory[(sim->address + i) % SIM_MEMORY_SIZE] = sim->page[i];
+        sim->page_count = 0;
+        // 80 02 at the history count wipes the history, like
+        // memreset8610 asks the station to
+        if (sim->memory[0x09] == 0x80 && sim->memory[0x0A] == 0x02)
+            sim->memory[0x09] = sim->memory[0x0A] = 0;
+        // The station pulls the data line low while it finishes the write
+        sim->phase = SIM_BUSY;
+        sim->bitcnt = 0;
+        sim->sda_out = 0;
+        return;
+    }
+    sim->phase = SIM_IDLE;
+}
+
+static void sim_clock_rise(struct sim_state *sim)
+{
+    if (sim->phase == SIM_RX && !sim->ack_slot && sim->bitcnt < 8)
+    {
+        sim->shift = (sim->shift << 1) | sim->sda;
+        sim->bitcnt++;
+    }
+    else if (sim->phase == SIM_TX && sim->bitcnt == 8)
+        sim->master_ack = !sim->sda;
+}
+
+static void sim_clock_fall(struct sim_state *sim)
+{
+    switch (sim->phase)
+    {
+    case SIM_RX:
+        if (sim->ack_slot)
+        {
+            sim->ack_slot = 0;
+            sim->bitcnt = 0;
+            sim->sda_out = 1;
+            if (sim->read_pending)
+            {
+                sim->read_pending = 0;
+                sim->phase = SIM_TX;
+                sim->sda_out = sim->memory[sim->address] >> 7;
+            }
+        }
+        else if (sim->bitcnt == 8)
+            sim_byte_received(sim);
+        break;
+
+    case SIM_TX:
+        sim->bitcnt++;
+        if (sim->bitcnt < 8)
+            sim->sda_out = (sim->memory[sim->address] >> (7 - sim->bitcnt)) & 1;
+        else if (sim->bitcnt == 8)
+            sim->sda_out = 1;
+        else if (sim->master_ack)
+        {
+            sim->address = (sim->address + 1) % SIM_MEMORY_SIZE;
+            sim->bitcnt = 0;
+            sim->master_ack = 0;
+            sim->sda_out = sim->memory[sim->address] >> 7;
+        }
+        else
+            sim->phase = SIM_IDLE;
+        break;
+
+    case SIM_BUSY:
+        // write_data() polls without a start condition, after the
+        // polling clocks the station is ready for the next command
+        if (++sim->bitcnt == SIM_BUSY_CLOCKS)
+            sim_start(sim);
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+/********************************************************************
+ * sim_open, simulator transport
+ *
+ * Inputs:  ws - handle to the weatherstation
+ *          device - memory map file to seed the station memory from,
+ *                   empty for SIM_DEFAULT_IMAGE
+ *
+ * Returns: 0 on success, -1 if the memory map cannot be loaded
+ *
+ ********************************************************************/
+static int sim_open(WEATHERSTATION ws, char *device)
+{
+    struct sim_state *sim;
+
+    if (device[0] == '\0')
+        device = SIM_DEFAULT_IMAGE;
+
+    if ((sim = calloc(1, sizeof(*sim))) == NULL)
+        return -1;
+
+    if (sim_load_image(sim->memory, device) < 0)
+    {
+        printf("\nUnable to load simulator memory map %s\n", device);
+        free(sim);
+        return -1;
+    }
+
+    // Lines come up asserted like on a freshly opened tty
+    sim->scl = 0;
+    sim->sda = 0;
+    sim->sda_out = 1;
+    sim->phase = SIM_IDLE;
+    ws->lines = TIOCM_DTR | TIOCM_RTS;
+    ws->lines_valid = 1;
+
+    ws->transport_data = sim;
+    return 0;
+}
+
+static void sim_close(WEATHERSTATION ws)
+{
+    free(ws->transport_data);
+    ws->transport_data = NULL;
+}
+
+static void sim_set_DTR(WEATHERSTATION ws, int val)
+{
+    struct sim_state *sim = ws->transport_data;
+    int scl = !val;
+
+    if (scl == sim->scl)
+        return;
+    sim->scl = scl;
+    if (scl)
+        sim_clock_rise(sim);
+    else
+        sim_clock_fall(sim);
+}
+
+static void sim_set_RTS(WEATHERSTATION ws, int val)
+{
+    struct sim_state *sim = ws->transport_data;
+    int sda = !val;
+
+    if (sda == sim->sda)
+        return;
+    sim->sda = sda;
+    if (sim->scl)
+    {
+        if (sda)
+            sim_stop(sim);
+        else
+            sim_start(sim);
+    }
+}
+
+/* DSR pulses once when the host drops both DTR and RTS at connect */
+static int sim_get_DSR(WEATHERSTATION ws)
+{
+    struct sim_state *sim = ws->transport_data;
+
+    if (!sim->scl || !sim->sda)
+        return 0;
+    return sim->dsr_polls++ == 0;
+}
+
+static int sim_get_CTS(WEATHERSTATION ws)
+{
+    struct sim_state *sim = ws->transport_data;
+
+    if (sim->noise > 0)
+    {
+        // xorshift64, reproducible for a given seed
+        sim->random ^= sim->random << 13;
+        sim->random ^= sim->random >> 7;
+        sim->random ^= sim->random << 17;
+        if ((sim->random >> 11) * (1.0 / 9007199254740992.0) < sim->noise)
+            return sim->sda_out;
+    }
+    return !sim->sda_out;
+}
+
+static int sim_read_device(WEATHERSTATION ws, unsigned char *buffer, int size)
+{
+    return 0;
+}
+
+static int sim_write_device(WEATHERSTATION ws, unsigned char *buffer, int size)
+{
+    return size;
+}
+
+const struct transport8610 sim_transport = {
+    "sim",
+    sim_open,
+    sim_close,
+    sim_set_DTR,
+    sim_set_RTS,
+    sim_get_DSR,
+    sim_get_CTS,
+    sim_read_device,
+    sim_write_device,
+    NULL,
+    NULL,
+    NULL
+};
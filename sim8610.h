@@ -0,0 +1,23 @@
+/* Include file for the open8610 WS-8610 station simulator
+ *
+ * The simulator is selected with a device name of the form
+ * sim:memmapfile (e.g. SERIAL_DEVICE sim:res/memmap in open8610.conf)
+ */
+
+#ifndef _INCLUDE_SIM8610_H_
+#define _INCLUDE_SIM8610_H_
+
+#include "rw8610.h"
+
+#define SIM_MEMORY_SIZE     0x8000
+#define SIM_DEFAULT_IMAGE   "res/memmap"
+#define SIM_PAGE_SIZE       80      // max bytes buffered by one write
+#define SIM_BUSY_CLOCKS     25      // clocks of write_data() ack polling
+
+extern const struct transport8610 sim_transport;
+
+int sim_load_image(unsigned char *memory, char *filename);
+unsigned char *sim_memory(WEATHERSTATION ws);
+void sim_set_noise(WEATHERSTATION ws, double rate, unsigned long seed);
+
+#endif /* _INCLUDE_SIM8610_H_ */
@@ -0,0 +1,467 @@
+/*  open8610  - sink8610 buffered output
+ *  This file collects the output of the command line tools in one
+ *  buffer and writes it out in as few system calls as possible, see
+ *  sink8610.h for the formats.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "sink8610.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ESCAPE_JSON     0       // JSON string, quoted
+#define ESCAPE_CSV      1       // CSV cell, quoted if needed
+#define ESCAPE_INFLUX   2       // line protocol string field, quoted
+#define ESCAPE_KEY      3       // line protocol measurement or key
+
+
+/* Writes a run of bytes to every file descriptor of the sink */
+static void write_out(struct sink *sink, const char *data, size_t length)
+{
+    int i;
+
+    for (i = 0; i < sink->fd_count; i++)
+    {
+        const char *p = data;
+        size_t left = length;
+        ssize_t n;
+
+        while (left > 0)
+        {
+            n = write(sink->fd[i], p, left);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                sink->error = 1;
+                break;
+            }
+            p += n;
+            left -= n;
+        }
+    }
+}
+
+/********************************************************************
+ * reserve
+ * Makes room for more bytes in the buffer. Only complete records are
+ * written out, the part of a record in progress is moved to the front
+ * so sink_end can still rewrite it.
+ *
+ * Input:   sink
+ *          needed - bytes about to be appended
+ *
+ ********************************************************************/
+static void reserve(struct sink *sink, size_t needed)
+{
+    size_t done;
+
+    if (sink->length + needed <= SINK_BUFFER_SIZE)
+        return;
+
+    fflush(stdout);
+    done = sink->in_record ? sink->record_start : sink->length;
+    write_out(sink, sink->buffer, done);
+    memmove(sink->buffer, sink->buffer + done, sink->length - done);
+    sink->length -= done;
+    sink->record_start = 0;
+
+    if (sink->length + needed > SINK_BUFFER_SIZE)
+    {
+        // A single record larger than the buffer, let it go in pieces
+        write_out(sink, sink->buffer, sink->length);
+        sink->length = 0;
+    }
+}
+
+static void append(struct sink *sink, const char *data, size_t length)
+{
+    reserve(sink, length);
+    memcpy(sink->buffer + sink->length, data, length);
+    sink->length += length;
+}
+
+static void append_str(struct sink *sink, const char *str)
+{
+    append(sink, str, strlen(str));
+}
+
+/********************************************************************
+ * append_escaped
+ * Appends a string quoted and escaped the way a format needs it
+ *
+ * Input:   sink
+ *          str - string, cut at SINK_VALUE_MAX characters
+ *          escape - ESCAPE_ style
+ *
+ ********************************************************************/
+static void append_escaped(struct sink *sink, const char *str, int escape)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t length = strnlen(str, SINK_VALUE_MAX);
+    int quote = escape != ESCAPE_KEY;
+    char *p;
+    size_t i;
+
+    if (escape == ESCAPE_CSV)
+        quote = strcspn(str, ",\"\r\n") < length;
+
+    reserve(sink, 6 * length + 2);
+    p = sink->buffer + sink->length;
+    if (quote)
+        *p++ = '"';
+    for (i = 0; i < length; i++)
+    {
+        unsigned char c = str[i];
+
+        switch (escape)
+        {
+        case ESCAPE_JSON:
+            if (c == '"' || c == '\\')
+                *p++ = '\\';
+            else if (c < 0x20)
+            {
+                memcpy(p, "\\u00", 4);
+                p[4] = hex[c >> 4];
+                p[5] = hex[c & 0x0F];
+                p += 6;
+                continue;
+            }
+            break;
+        case ESCAPE_CSV:
+            if (c == '"')
+                *p++ = '"';
+            break;
+        case ESCAPE_INFLUX:
+            if (c == '"' || c == '\\')
+                *p++ = '\\';
+            break;
+        case ESCAPE_KEY:
+            if (c == ',' || c == '=' || c == ' ')
+                *p++ = '\\';
+            break;
+        }
+        *p++ = c;
+    }
+    if (quote)
+        *p++ = '"';
+    sink->length = p - sink->buffer;
+}
+
+/********************************************************************
+ * add_field
+ * Appends one field of the current record
+ *
+ * Input:   sink
+ *          key - field name, NULL for a field only shown as text
+ *          value - formatted value
+ *          number - 1 if the value is a number
+ *
+ ********************************************************************/
+static void add_field(struct sink *sink, const char *key, const char *value,
+                      int number)
+{
+    int missing = number && strcmp(value, "-") == 0;
+
+    if (sink->format == SINK_TEXT)
+    {
+        if (sink->fields++ > 0)
+            append_str(sink, " | ");
+        if (key != NULL)
+        {
+            append_str(sink, key);
+            append_str(sink, ": ");
+        }
+        append_str(sink, value);
+        return;
+    }
+
+    if (key == NULL)
+        return;
+
+    switch (sink->format)
+    {
+    case SINK_CSV:
+        // The time column always comes first
+        append_str(sink, ",");
+        if (sink->header)
+            sink->header_length += snprintf(sink->header_line + sink->header_length,
+                                            SINK_HEADER_SIZE - sink->header_length,
+                                            ",%s", key);
+        if (sink->header_length >= SINK_HEADER_SIZE)
+            sink->header_length = SINK_HEADER_SIZE - 1;
+        if (number && !missing)
+            append_str(sink, value);
+        else if (!missing)
+            append_escaped(sink, value, ESCAPE_CSV);
+        break;
+
+    case SINK_JSON:
+        append_str(sink, ",");
+        append_escaped(sink, key, ESCAPE_JSON);
+        append_str(sink, ":");
+        if (missing)
+            append_str(sink, "null");
+        else if (number)
+            append_str(sink, value);
+        else
+            append_escaped(sink, value, ESCAPE_JSON);
+        break;
+
+    case SINK_INFLUX:
+        if (missing)
+            return;
+        append_str(sink, sink->fields > 0 ? "," : " ");
+        append_escaped(sink, key, ESCAPE_KEY);
+        append_str(sink, "=");
+        if (number)
+            append_str(sink, value);
+        else
+            append_escaped(sink, value, ESCAPE_INFLUX);
+        break;
+    }
+    sink->fields++;
+}
+
+
+/********************************************************************
+ * sink_format
+ * Looks up an output format by name
+ *
+ * Input:   name - text, csv, json or influx
+ *
+ * Returns: SINK_ format, -1 if the name is unknown
+ *
+ ********************************************************************/
+int sink_format(const char *name)
+{
+    if (strcmp(name, "text") == 0)
+        return SINK_TEXT;
+    if (strcmp(name, "csv") == 0)
+        return SINK_CSV;
+    if (strcmp(name, "json") == 0)
+        return SINK_JSON;
+    if (strcmp(name, "influx") == 0)
+        return SINK_INFLUX;
+    return -1;
+}
+
+/********************************************************************
+ * sink_open
+ * Sets up an empty sink without file descriptors
+ *
+ * Input:   sink
+ *          format - SINK_ format of records
+ *          header - 1 to start CSV output with a header line, 0 when
+ *                   appending to a file that already has one
+ *
+ ********************************************************************/
+void sink_open(struct sink *sink, int format, int header)
+{
+    sink->format = format;
+    sink->header = format == SINK_CSV && header;
+    sink->fd_count = 0;
+    sink->error = 0;
+    sink->fields = 0;
+    sink->in_record = 0;
+    sink->record_start = 0;
+    sink->header_length = 0;
+    sink->length = 0;
+}
+
+/********************************************************************
+ * sink_add_fd
+ * Adds a file descriptor every flush is written to
+ *
+ * Input:   sink
+ *          fd - open file descriptor, e.g. fileno() of a FILE that is
+ *               otherwise not written to
+ *
+ ********************************************************************/
+void sink_add_fd(struct sink *sink, int fd)
+{
+    if (sink->fd_count < SINK_MAX_FD)
+        sink->fd[sink->fd_count++] = fd;
+}
+
+/********************************************************************
+ * sink_printf
+ * Appends free text, whatever the format of the sink
+ *
+ * Input:   sink
+ *          format, ... - as printf
+ *
+ ********************************************************************/
+void sink_printf(struct sink *sink, const char *format, ...)
+{
+    va_list ap;
+    size_t room = SINK_BUFFER_SIZE - sink->length;
+    int n;
+
+    va_start(ap, format);
+    n = vsnprintf(sink->buffer + sink->length, room, format, ap);
+    va_end(ap);
+    if (n < 0)
+        return;
+
+    if ((size_t)n >= room)
+    {
+        reserve(sink, n + 1);
+        room = SINK_BUFFER_SIZE - sink->length;
+        va_start(ap, format);
+        n = vsnprintf(sink->buffer + sink->length, room, format, ap);
+        va_end(ap);
+        if ((size_t)n >= room)
+            n = room - 1;
+    }
+    sink->length += n;
+}
+
+/********************************************************************
+ * sink_hex
+ * Appends bytes as two digit hex numbers each followed by a space
+ *
+ * Input:   sink
+ *          data - bytes
+ *          count - number of bytes
+ *
+ ********************************************************************/
+void sink_hex(struct sink *sink, const unsigned char *data, int count)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char *p;
+    int i;
+
+    reserve(sink, 3 * (size_t)count);
+    p = sink->buffer + sink->length;
+    for (i = 0; i < count; i++)
+    {
+        *p++ = hex[data[i] >> 4];
+        *p++ = hex[data[i] & 0x0F];
+        *p++ = ' ';
+    }
+    sink->length = p - sink->buffer;
+}
+
+/********************************************************************
+ * sink_begin
+ * Starts a record
+ *
+ * Input:   sink
+ *          measurement - InfluxDB measurement name
+ *          time - time of the record, seconds since 1/1/1970 UTC
+ *
+ ********************************************************************/
+void sink_begin(struct sink *sink, const char *measurement, time_t time)
+{
+    sink->in_record = 1;
+    sink->record_start = sink->length;
+    sink->fields = 0;
+    sink->time = time;
+
+    switch (sink->format)
+    {
+    case SINK_CSV:
+        if (sink->header)
+            sink->header_length = snprintf(sink->header_line, SINK_HEADER_SIZE, "time");
+        sink_printf(sink, "%ld", (long)time);
+        break;
+    case SINK_JSON:
+        sink_printf(sink, "{\"time\":%ld", (long)time);
+        break;
+    case SINK_INFLUX:
+        append_escaped(sink, measurement, ESCAPE_KEY);
+        break;
+    }
+}
+
+void sink_string(struct sink *sink, const char *key, const char *value)
+{
+    add_field(sink, key, value, 0);
+}
+
+void sink_number(struct sink *sink, const char *key, const char *value)
+{
+    add_field(sink, key, value, 1);
+}
+
+/********************************************************************
+ * sink_end
+ * Completes a record. The first CSV record gets the header line put
+ * in front of it; an InfluxDB line without any field is dropped.
+ *
+ * Input:   sink
+ *
+ ********************************************************************/
+void sink_end(struct sink *sink)
+{
+    switch (sink->format)
+    {
+    case SINK_TEXT:
+        append_str(sink, "\n");
+        break;
+    case SINK_CSV:
+        append_str(sink, "\n");
+        if (sink->header)
+        {
+            sink->header_line[sink->header_length++] = '\n';
+            reserve(sink, sink->header_length);
+            memmove(sink->buffer + sink->record_start + sink->header_length,
+                    sink->buffer + sink->record_start,
+                    sink->length - sink->record_start);
+            memcpy(sink->buffer + sink->record_start, sink->header_line,
+                   sink->header_length);
+            sink->length += sink->header_length;
+            sink->header = 0;
+        }
+        break;
+    case SINK_JSON:
+        append_str(sink, "}\n");
+        break;
+    case SINK_INFLUX:
+        // Line protocol times are in ns
+        if (sink->fields == 0)
+            sink->length = sink->record_start;
+        else
+            sink_printf(sink, " %ld000000000\n", (long)sink->time);
+        break;
+    }
+    sink->in_record = 0;
+}
+
+/********************************************************************
+ * sink_flush
+ * Writes out the buffer, one write() per file descriptor. Pending
+ * stdio output to stdout goes first so it keeps its place.
+ *
+ * Input:   sink
+ *
+ * Returns: 0 on success, -1 if a write has failed since the last flush
+ *
+ ********************************************************************/
+int sink_flush(struct sink *sink)
+{
+    int error;
+
+    fflush(stdout);
+    write_out(sink, sink->buffer, sink->length);
+    sink->length = 0;
+    sink->record_start = 0;
+
+    error = sink->error;
+    sink->error = 0;
+    return error ? -1 : 0;
+}
+
+int sink_close(struct sink *sink)
+{
+    int ret = sink_flush(sink);
+
+    sink->fd_count = 0;
+    return ret;
+}
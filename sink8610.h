@@ -0,0 +1,72 @@
+/* Include file for the open8610 output sink
+ *
+ * The command line tools write their output through a sink: one large
+ * buffer that is handed to write() once per flush, to any number of
+ * file descriptors (e.g. stdout and a log file). Output is either free
+ * text, or records of named fields rendered as plain text, CSV, JSON
+ * lines or InfluxDB line protocol.
+ */
+
+#ifndef _INCLUDE_SINK8610_H_
+#define _INCLUDE_SINK8610_H_
+
+#include <stddef.h>
+#include <time.h>
+
+#define SINK_TEXT           0       // key: value | key: value
+#define SINK_CSV            1       // time,key,... header then values
+#define SINK_JSON           2       // one JSON object per line
+#define SINK_INFLUX         3       // InfluxDB line protocol
+
+#define SINK_BUFFER_SIZE    65536
+#define SINK_MAX_FD         2
+#define SINK_HEADER_SIZE    1024    // CSV header line
+#define SINK_VALUE_MAX      256     // longest formatted field
+
+/* A record starts with sink_begin, gets its fields in order and ends
+ * with sink_end. Fields without a key only show in the text format,
+ * the other formats carry the time given to sink_begin instead.
+ * Numbers are passed formatted; "-", as written by temp2str and RH2str
+ * for a missing sensor, is written as an empty CSV cell, a JSON null
+ * and left out of an InfluxDB line. */
+struct sink
+{
+    int format;                     // SINK_ format
+    int header;                     // CSV header still to be written
+    int fd[SINK_MAX_FD];
+    int fd_count;
+    int error;                      // a write failed
+    int fields;                     // fields written to the current record
+    int in_record;
+    time_t time;                    // time of the current record
+    size_t record_start;            // offset of the current record
+    size_t header_length;
+    size_t length;
+    char header_line[SINK_HEADER_SIZE];
+    char buffer[SINK_BUFFER_SIZE];
+};
+
+int sink_format(const char *name);
+
+void sink_open(struct sink *sink, int format, int header);
+
+void sink_add_fd(struct sink *sink, int fd);
+
+void sink_printf(struct sink *sink, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+void sink_hex(struct sink *sink, const unsigned char *data, int count);
+
+void sink_begin(struct sink *sink, const char *measurement, time_t time);
+
+void sink_string(struct sink *sink, const char *key, const char *value);
+
+void sink_number(struct sink *sink, const char *key, const char *value);
+
+void sink_end(struct sink *sink);
+
+int sink_flush(struct sink *sink);
+
+int sink_close(struct sink *sink);
+
+#endif /* _INCLUDE_SINK8610_H_ */
@@ -0,0 +1,192 @@
+/*  open8610  - stats8610 link statistics
+ *  This file keeps count of how reads from the station go and writes
+ *  the counters as Prometheus metrics, see stats8610.h.
+ *
+ *  This program is published under the GNU General Public license
+ */
+
+#include "rw8610.h"
+
+static const int retry_bounds[STATS_RETRY_BUCKETS - 1] = { 0, 1, 2, 5, 10 };
+
+
+/********************************************************************
+ * stats_read_done
+ * Counts one finished read_safe() call
+ *
+ * Input:   stats - counters to update
+ *          elapsed_ns - time the call took
+ *          retries - blocks read again
+ *          bytes - bytes returned, -1 if the call failed
+ *
+ ********************************************************************/
+void stats_read_done(struct link_stats *stats, long long elapsed_ns,
+                     int retries, int bytes)
+{
+    int i;
+
+    stats->reads++;
+    stats->transfer_ns += elapsed_ns;
+    if (bytes < 0)
+    {
+        stats->read_failures++;
+        return;
+    }
+
+    // Only successful calls are in the histogram, its sum too
+    stats->retries += retries;
+    stats->read_bytes += bytes;
+    stats->last_success = time(NULL);
+    for (i = 0; i < STATS_RETRY_BUCKETS - 1 && retries > retry_bounds[i]; i++)
+        ;
+    stats->retry_buckets[i]++;
+}
+
+/********************************************************************
+ * stats_add
+ * Adds counters to a total, e.g. to keep them over a reopen
+ *
+ * Input:   total - counters to add to
+ *          stats - counters added
+ *
+ ********************************************************************/
+void stats_add(struct link_stats *total, const struct link_stats *stats)
+{
+    int i;
+
+    total->connects += stats->connects;
+    total->connect_ns += stats->connect_ns;
+    total->handshake_ns += stats->handshake_ns;
+    total->reads += stats->reads;
+    total->read_failures += stats->read_failures;
+    total->read_bytes += stats->read_bytes;
+    total->transfer_ns += stats->transfer_ns;
+    total->mismatches += stats->mismatches;
+    total->zero_rejects += stats->zero_rejects;
+    total->retries += stats->retries;
+    for (i = 0; i < STATS_RETRY_BUCKETS; i++)
+        total->retry_buckets[i] += stats->retry_buckets[i];
+    if (stats->last_success > total->last_success)
+        total->last_success = stats->last_success;
+    total->blocks += stats->blocks;
+    total->line_bytes += stats->line_bytes;
+    total->ioctls += stats->ioctls;
+}
+
+/* Writes HELP and TYPE of a metric and its one sample */
+static void metric(FILE *fileptr, const char *name, const char *type,
+                   const char *help, const char *label, double value)
+{
+    fprintf(fileptr, "# HELP " STATS_PREFIX "%s %s\n", name, help);
+    fprintf(fileptr, "# TYPE " STATS_PREFIX "%s %s\n", name, type);
+    fprintf(fileptr, STATS_PREFIX "%s{%s} %.10g\n", name, label, value);
+}
+
+/********************************************************************
+ * stats_write
+ * Writes the counters of a station in the Prometheus text format
+ *
+ * Input:   fileptr - where to write
+ *          ws - station handle
+ *          device - device name, the value of the device label
+ *
+ * Returns: 0 on success, -1 on write error
+ *
+ ********************************************************************/
+int stats_write(FILE *fileptr, struct weatherstation *ws, const char *device)
+{
+    const struct link_stats *stats = &ws->stats;
+    char label[200];
+    unsigned long count = 0;
+    int i, n;
+
+    // Label values escape backslash, quote and newline
+    n = snprintf(label, sizeof(label), "device=\"");
+    for (; *device != '\0' && n < (int)sizeof(label) - 4; device++)
+    {
+        if (*device == '\\' || *device == '"' || *device == '\n')
+            label[n++] = '\\';
+        label[n++] = *device == '\n' ? 'n' : *device;
+    }
+    label[n++] = '"';
+    label[n] = '\0';
+
+    metric(fileptr, "connects_total", "counter",
+           "Handshakes with the station completed.", label, stats->connects);
+    metric(fileptr, "connect_seconds_total", "counter",
+           "Time spent opening the station.", label, stats->connect_ns / 1e9);
+    metric(fileptr, "handshake_seconds_total", "counter",
+           "Time spent waiting for the station to answer the handshake.",
+           label, stats->handshake_ns / 1e9);
+    metric(fileptr, "reads_total", "counter",
+           "read_safe() calls.", label, stats->reads);
+    metric(fileptr, "read_failures_total", "counter",
+           "read_safe() calls that gave up.", label, stats->read_failures);
+    metric(fileptr, "read_bytes_total", "counter",
+           "Bytes returned by successful reads.", label, stats->read_bytes);
+    metric(fileptr, "transfer_seconds_total", "counter",
+           "Time spent in read_safe().", label, stats->transfer_ns / 1e9);
+    metric(fileptr, "read_blocks_total", "counter",
+           "Blocks read and verified.", label, stats->blocks);
+    metric(fileptr, "read_mismatches_total", "counter",
+           "Blocks whose verification readings disagreed.", label, stats->mismatches);
+    metric(fileptr, "read_zero_rejects_total", "counter",
+           "Reads rejected for returning only zeros.", label, stats->zero_rejects);
+    metric(fileptr, "line_bytes_total", "counter",
+           "Bytes clocked to and from the station.", label, stats->line_bytes);
+    metric(fileptr, "line_ioctls_total", "counter",
+           "Modem line accesses.", label, stats->ioctls);
+    metric(fileptr, "mismatch_rate", "gauge",
+           "Share of recent blocks read unequal.", label, ws->mismatch_rate);
+    metric(fileptr, "last_success_timestamp_seconds", "gauge",
+           "Time of the last successful read.", label, stats->last_success);
+
+    fprintf(fileptr, "# HELP " STATS_PREFIX "read_retries Blocks read again per successful read_safe() call.\n");
+    fprintf(fileptr, "# TYPE " STATS_PREFIX "read_retries histogram\n");
+    for (i = 0; i < STATS_RETRY_BUCKETS; i++)
+    {
+        count += stats->retry_buckets[i];
+        if (i < STATS_RETRY_BUCKETS - 1)
+            fprintf(fileptr, STATS_PREFIX "read_retries_bucket{%s,le=\"%d\"} %lu\n",
+                    label, retry_bounds[i], count);
+        else
+            fprintf(fileptr, STATS_PREFIX "read_retries_bucket{%s,le=\"+Inf\"} %lu\n",
+                    label, count);
+    }
+    fprintf(fileptr, STATS_PREFIX "read_retries_sum{%s} %lu\n", label, stats->retries);
+    fprintf(fileptr, STATS_PREFIX "read_retries_count{%s} %lu\n", label, count);
+
+    return ferror(fileptr) ? -1 : 0;
+}
+
+/********************************************************************
+ * stats_write_textfile
+ * Replaces a textfile collector file with the current counters. The
+ * file is written under a temporary name and renamed, so the exporter
+ * never reads half of it.
+ *
+ * Input:   ws - station handle
+ *          filename - .prom file to write
+ *          device - device name, the value of the device label
+ *
+ * Returns: 0 on success, -1 on error
+ *
+ ********************************************************************/
+int stats_write_textfile(struct weatherstation *ws, const char *filename,
+                         const char *device)
+{
+    char tmpname[1024];
+    FILE *fileptr;
+    int ret;
+
+    snprintf(tmpname, sizeof(tmpname), "%s.%d.tmp", filename, (int)getpid());
+    if ((fileptr = fopen(tmpname, "w")) == NULL)
+        return -1;
+    ret = stats_write(fileptr, ws, device);
+    if (fclose(fileptr) != 0 || ret < 0 || rename(tmpname, filename) < 0)
+    {
+        unlink(tmpname);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+/* Include file for the open8610 link statistics
+ *
+ * Every station handle counts how its reads went. The counters are
+ * written in the Prometheus text format, to a file for the node
+ * exporter textfile collector (METRICS_FILE) and by open8610d over
+ * HTTP (METRICS_PORT).
+ */
+
+#ifndef _INCLUDE_STATS8610_H_
+#define _INCLUDE_STATS8610_H_
+
+#include <stdio.h>
+#include <time.h>
+
+#define STATS_RETRY_BUCKETS     6       // retries per read: 0, 1, 2, 5, 10, more
+#define STATS_PREFIX            "ws8610_"
+
+struct link_stats
+{
+    unsigned long connects;             // handshakes completed
+    long long connect_ns;               // time spent opening the station
+    long long handshake_ns;             // of it waiting for the station's DSR
+    unsigned long reads;                // read_safe() calls
+    unsigned long read_failures;        // calls that gave up
+    unsigned long read_bytes;           // bytes returned by successful calls
+    long long transfer_ns;              // time spent in read_safe()
+    unsigned long mismatches;           // blocks read unequal
+    unsigned long zero_rejects;         // whole reads rejected as only zeros
+    unsigned long retries;              // blocks read again, successful calls
+    unsigned long retry_buckets[STATS_RETRY_BUCKETS];
+    time_t last_success;                // end of the last successful read
+    unsigned long blocks;               // blocks read and verified
+    unsigned long line_bytes;           // bytes clocked to and from the station
+    unsigned long ioctls;               // modem line accesses
+};
+
+struct weatherstation;
+
+void stats_read_done(struct link_stats *stats, long long elapsed_ns,
+                     int retries, int bytes);
+
+void stats_add(struct link_stats *total, const struct link_stats *stats);
+
+int stats_write(FILE *fileptr, struct weatherstation *ws, const char *device);
+
+int stats_write_textfile(struct weatherstation *ws, const char *filename,
+                         const char *device);
+
+#endif /* _INCLUDE_STATS8610_H_ */